@@ -1,6 +1,7 @@
 #include "rtsp/server/live_media_subsession.h"
 #include "rtsp/server/capture_framed_source.h"
 #include "rtsp/server/video_encoder_host.h"
+#include "rtsp/base/message_pump_live.h"
 #include "base/threading/thread_task_runner_handle.h"
 #include "base/run_loop.h"
 
@@ -11,11 +12,18 @@ LiveMediaSubSession *LiveMediaSubSession::createNew(UsageEnvironment &env, Boole
   return new LiveMediaSubSession(env, reuseFirstSource, av_codec_id, video_encoder_host);
 }
 
+LiveMediaSubSession *LiveMediaSubSession::createNew(UsageEnvironment &env, Boolean reuseFirstSource,
+                                                    AVCodecID av_codec_id,
+                                                    const ReplayOptions &replay_options) {
+  return new LiveMediaSubSession(env, reuseFirstSource, av_codec_id, replay_options);
+}
+
 LiveMediaSubSession::LiveMediaSubSession(UsageEnvironment &env, Boolean reuseFirstSource,
                                          AVCodecID av_codec_id,
                                          VideoEncoderHost *video_encoder_host)
     : OnDemandServerMediaSubsession(env, reuseFirstSource),
       av_codec_id_(av_codec_id),
+      reuse_first_source_(reuseFirstSource),
       video_encoder_host_(video_encoder_host), fDone(false),
       fDummyRTPSink(nullptr), fAuxSDPLine(nullptr),
       task_runner_(base::ThreadTaskRunnerHandle::Get()),
@@ -23,8 +31,22 @@ LiveMediaSubSession::LiveMediaSubSession(UsageEnvironment &env, Boolean reuseFir
   LOG(INFO) << __func__;
 }
 
+LiveMediaSubSession::LiveMediaSubSession(UsageEnvironment &env, Boolean reuseFirstSource,
+                                         AVCodecID av_codec_id,
+                                         const ReplayOptions &replay_options)
+    : OnDemandServerMediaSubsession(env, reuseFirstSource),
+      av_codec_id_(av_codec_id),
+      reuse_first_source_(reuseFirstSource),
+      video_encoder_host_(nullptr), replay_options_(replay_options), fDone(false),
+      fDummyRTPSink(nullptr), fAuxSDPLine(nullptr),
+      task_runner_(base::ThreadTaskRunnerHandle::Get()),
+      weak_factory_(this) {
+  LOG(INFO) << __func__ << ",replay:" << replay_options_.path.value();
+}
+
 LiveMediaSubSession::~LiveMediaSubSession() {
   LOG(INFO) << __func__;
+  StopRecording();
   setDoneFlag();
   if (fAuxSDPLine) {
     delete[] fAuxSDPLine;
@@ -117,12 +139,63 @@ void LiveMediaSubSession::WaitCompleted() {
   LOG(INFO) << __func__ << ",RunLoop end:[" << (base::TimeTicks::Now() - t1).InMicroseconds() << "]";
 }
 
+FramedSource *LiveMediaSubSession::createFrameSource() {
+  if (!replay_options_.path.empty()) {
+    return ReplayFramedSource::createNew(envir(), av_codec_id_, replay_options_);
+  }
+  return CaptureFramedSource::createNew(envir(), av_codec_id_, video_encoder_host_);
+}
+
+bool LiveMediaSubSession::StartRecording(const RecordingOptions &options) {
+  LOG(INFO) << __func__ << "," << options.directory.value();
+  if (recording_sink_) {
+    LOG(INFO) << __func__ << ",already recording";
+    return true;
+  }
+  auto source = createFrameSource();
+  if (!source) {
+    return false;
+  }
+  recording_sink_ = RecordingSink::createNew(envir(), av_codec_id_, options);
+  if (!recording_sink_) {
+    Medium::close(source);
+    return false;
+  }
+  recording_source_ = source;
+  recording_sink_->startPlaying(*recording_source_, afterRecording, this);
+  return true;
+}
+
+void LiveMediaSubSession::StopRecording() {
+  if (!recording_sink_) {
+    return;
+  }
+  LOG(INFO) << __func__;
+  recording_sink_->stopPlaying();
+  Medium::close(recording_sink_);
+  recording_sink_ = nullptr;
+  Medium::close(recording_source_);
+  recording_source_ = nullptr;
+}
+
+void LiveMediaSubSession::afterRecording(void *clientData) {
+  LOG(INFO) << __func__ << ",source closed";
+  auto *that = reinterpret_cast<LiveMediaSubSession *>(clientData);
+  // We are inside the source's closure handler, close it from a fresh task.
+  that->task_runner_->PostTask(FROM_HERE,
+                               base::BindOnce(&LiveMediaSubSession::StopRecording,
+                                              that->weak_factory_.GetWeakPtr()));
+}
+
 FramedSource *LiveMediaSubSession::createNewStreamSource(unsigned clientSessionId,
                                                          unsigned &estBitrate) {
   LOG(INFO) << __func__ << ",createNewStreamSource clientSessionId:" << clientSessionId;
   estBitrate = 8000; // 1080p 8000kbit/s
 
-  auto frame_source = CaptureFramedSource::createNew(envir(), av_codec_id_, video_encoder_host_);
+  auto frame_source = createFrameSource();
+  if (!frame_source) {
+    return nullptr;
+  }
   if (av_codec_id_ == AV_CODEC_ID_HEVC) {
     return H265VideoStreamDiscreteFramer::createNew(envir(), frame_source);
   }
@@ -144,4 +217,58 @@ RTPSink *LiveMediaSubSession::createNewRTPSink(Groupsock *rtpGroupsock,
   }
   return H264VideoRTPSink::createNew(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic);
 }
+
+void LiveMediaSubSession::getStreamParameters(unsigned clientSessionId,
+                                              netAddressBits clientAddress,
+                                              Port const &clientRTPPort,
+                                              Port const &clientRTCPPort,
+                                              int tcpSocketNum,
+                                              unsigned char rtpChannelId,
+                                              unsigned char rtcpChannelId,
+                                              netAddressBits &destinationAddress,
+                                              u_int8_t &destinationTTL,
+                                              Boolean &isMulticast,
+                                              Port &serverRTPPort,
+                                              Port &serverRTCPPort,
+                                              void *&streamToken) {
+  OnDemandServerMediaSubsession::getStreamParameters(clientSessionId, clientAddress,
+                                                     clientRTPPort, clientRTCPPort,
+                                                     tcpSocketNum, rtpChannelId, rtcpChannelId,
+                                                     destinationAddress, destinationTTL,
+                                                     isMulticast, serverRTPPort, serverRTCPPort,
+                                                     streamToken);
+  auto scheduler = MessagePumpLive::scheduler();
+  auto stream_state = static_cast<StreamState *>(streamToken);
+  if (!scheduler || !stream_state) {
+    return;
+  }
+  // RTP-over-TCP shares the RTSP connection socket.
+  if (tcpSocketNum >= 0) {
+    scheduler->setSocketSession(tcpSocketNum, clientSessionId);
+  }
+  // With reuseFirstSource every session shares one StreamState, its sink and
+  // source belong to no single session and stay on the shared delay queue.
+  if (reuse_first_source_) {
+    return;
+  }
+  // MultiFramedRTPSink::sendNext() is scheduled with the sink as clientData.
+  if (stream_state->rtpSink()) {
+    scheduler->setClientDataSession(stream_state->rtpSink(), clientSessionId);
+  }
+  // createNewStreamSource() always returns a framer over CaptureFramedSource.
+  if (stream_state->mediaSource()) {
+    auto framer = static_cast<FramedFilter *>(stream_state->mediaSource());
+    scheduler->setClientDataSession(framer, clientSessionId);
+    scheduler->setClientDataSession(framer->inputSource(), clientSessionId);
+  }
+}
+
+void LiveMediaSubSession::deleteStream(unsigned clientSessionId, void *&streamToken) {
+  LOG(INFO) << __func__ << ",clientSessionId:" << clientSessionId;
+  auto scheduler = MessagePumpLive::scheduler();
+  if (scheduler) {
+    scheduler->clearSession(clientSessionId);
+  }
+  OnDemandServerMediaSubsession::deleteStream(clientSessionId, streamToken);
+}
 }
@@ -10,6 +10,8 @@
 #include "base/single_thread_task_runner.h"
 #include "base/memory/weak_ptr.h"
 #include "base/timer/timer.h"
+#include "rtsp/server/recording_sink.h"
+#include "rtsp/server/replay_framed_source.h"
 #include <liveMedia.hh>
 
 namespace rtsp {
@@ -20,12 +22,25 @@ public:
                                        Boolean reuseFirstSource,
                                        AVCodecID av_codec_id,
                                        VideoEncoderHost *video_encoder_host);
+ // Streams a recorded elementary stream instead of the encoder, for load tests.
+ static LiveMediaSubSession *createNew(UsageEnvironment &env,
+                                       Boolean reuseFirstSource,
+                                       AVCodecID av_codec_id,
+                                       const ReplayOptions &replay_options);
  void afterPlayingDummy1();
+ // Record the encoded stream to MPEG-TS segments, independent of any RTSP
+ // client. Call on the live thread.
+ bool StartRecording(const RecordingOptions &options);
+ void StopRecording();
 protected:
  explicit LiveMediaSubSession(UsageEnvironment &env,
                               Boolean reuseFirstSource,
                               AVCodecID av_codec_id,
                               VideoEncoderHost *video_encoder_host);
+ explicit LiveMediaSubSession(UsageEnvironment &env,
+                              Boolean reuseFirstSource,
+                              AVCodecID av_codec_id,
+                              const ReplayOptions &replay_options);
  virtual ~LiveMediaSubSession();
 private:
  char const *getAuxSDPLine(RTPSink *rtpSink,
@@ -37,15 +52,39 @@ private:
  RTPSink *createNewRTPSink(Groupsock *rtpGroupsock,
                            unsigned char rtpPayloadTypeIfDynamic,
                            FramedSource *inputSource) override;
+ // Tag the stream's sockets and frame delivery with |clientSessionId| so
+ // LiveTaskScheduler can share the live thread fairly between sessions.
+ // Streams shared through reuseFirstSource only tag the RTP-over-TCP socket.
+ void getStreamParameters(unsigned clientSessionId,
+                          netAddressBits clientAddress,
+                          Port const &clientRTPPort,
+                          Port const &clientRTCPPort,
+                          int tcpSocketNum,
+                          unsigned char rtpChannelId,
+                          unsigned char rtcpChannelId,
+                          netAddressBits &destinationAddress,
+                          u_int8_t &destinationTTL,
+                          Boolean &isMulticast,
+                          Port &serverRTPPort,
+                          Port &serverRTCPPort,
+                          void *&streamToken) override;
+ void deleteStream(unsigned clientSessionId, void *&streamToken) override;
+ FramedSource *createFrameSource();
+ static void afterRecording(void *clientData);
  void checkForAuxSDPLine();
  void setDoneFlag();
  void WaitCompleted();
 
  AVCodecID av_codec_id_;
+ // OnDemandServerMediaSubsession keeps its own copy private.
+ bool reuse_first_source_;
  VideoEncoderHost *video_encoder_host_;
+ ReplayOptions replay_options_;
  bool fDone;        // used when setting up 'SDPlines'
  RTPSink *fDummyRTPSink; // ditto
  char *fAuxSDPLine;
+ FramedSource *recording_source_ = nullptr;
+ RecordingSink *recording_sink_ = nullptr;
  base::Closure quit_closure_;
  base::OneShotTimer check_timer_;
  scoped_refptr<base::SingleThreadTaskRunner> task_runner_;
@@ -0,0 +1,146 @@
+#include "rtsp/server/live_rtsp_server.h"
+#include "rtsp/base/message_pump_live.h"
+#include "base/logging.h"
+#include <stdio.h>
+
+namespace rtsp {
+LiveRTSPServer *LiveRTSPServer::createNew(UsageEnvironment &env,
+                                          Port ourPort,
+                                          UserAuthenticationDatabase *authDatabase,
+                                          const AdmissionPolicy &policy,
+                                          unsigned reclamationSeconds) {
+  int ourSocket = setUpOurSocket(env, ourPort);
+  if (ourSocket == -1) {
+    LOG(ERROR) << __func__ << ",setUpOurSocket failed:" << env.getResultMsg();
+    return nullptr;
+  }
+  return new LiveRTSPServer(env, ourSocket, ourPort, authDatabase, policy, reclamationSeconds);
+}
+
+LiveRTSPServer::LiveRTSPServer(UsageEnvironment &env,
+                               int ourSocket,
+                               Port ourPort,
+                               UserAuthenticationDatabase *authDatabase,
+                               const AdmissionPolicy &policy,
+                               unsigned reclamationSeconds)
+    : RTSPServer(env, ourSocket, ourPort, authDatabase, reclamationSeconds),
+      policy_(policy) {
+  LOG(INFO) << __func__ << ",max utilization[" << policy_.max_utilization
+            << "],max lateness[" << policy_.max_lateness.InMilliseconds()
+            << "ms],session cost[" << policy_.session_cost
+            << "],settle time[" << policy_.settle_time.InSeconds()
+            << "s],alternate server[" << policy_.alternate_server << "]";
+}
+
+LiveRTSPServer::~LiveRTSPServer() {
+  LOG(INFO) << __func__;
+}
+
+bool LiveRTSPServer::CanAdmit() {
+  const base::TimeTicks now = base::TimeTicks::Now();
+  while (!recent_admissions_.empty() &&
+      now - recent_admissions_.front() >= policy_.settle_time) {
+    recent_admissions_.pop_front();
+  }
+  MessagePumpLive::LoadStats load = MessagePumpLive::load();
+  const double projected = load.utilization + recent_admissions_.size() * policy_.session_cost;
+  if (projected > policy_.max_utilization ||
+      load.max_lateness > policy_.max_lateness) {
+    LOG(WARNING) << __func__ << ",live thread overloaded,utilization[" << load.utilization
+                 << "],recently admitted[" << recent_admissions_.size()
+                 << "],max lateness[" << load.max_lateness.InMilliseconds() << "ms]";
+    return false;
+  }
+  return true;
+}
+
+void LiveRTSPServer::NoteAdmitted() {
+  recent_admissions_.push_back(base::TimeTicks::Now());
+}
+
+GenericMediaServer::ClientConnection *
+LiveRTSPServer::createNewClientConnection(int clientSocket, struct sockaddr_in clientAddr) {
+  return new LiveRTSPClientConnection(*this, clientSocket, clientAddr);
+}
+
+GenericMediaServer::ClientSession *
+LiveRTSPServer::createNewClientSession(u_int32_t sessionId) {
+  return new LiveRTSPClientSession(*this, sessionId);
+}
+
+LiveRTSPServer::LiveRTSPClientConnection::LiveRTSPClientConnection(LiveRTSPServer &ourServer,
+                                                                   int clientSocket,
+                                                                   struct sockaddr_in clientAddr)
+    : RTSPClientConnection(ourServer, clientSocket, clientAddr),
+      server_(ourServer) {}
+
+LiveRTSPServer::LiveRTSPClientConnection::~LiveRTSPClientConnection() = default;
+
+void LiveRTSPServer::LiveRTSPClientConnection::RespondOverloaded(char const *urlPreSuffix,
+                                                                 char const *urlSuffix) {
+  const AdmissionPolicy &policy = server_.policy();
+  if (policy.alternate_server.empty()) {
+    snprintf((char *) fResponseBuffer, sizeof fResponseBuffer,
+             "RTSP/1.0 503 Service Unavailable\r\n"
+             "CSeq: %s\r\n"
+             "%s"
+             "Retry-After: %u\r\n\r\n",
+             fCurrentCSeq, dateHeader(), policy.retry_after);
+    return;
+  }
+  std::string location = policy.alternate_server;
+  if (urlPreSuffix && urlPreSuffix[0] != '\0') {
+    location.append("/").append(urlPreSuffix);
+  }
+  if (urlSuffix && urlSuffix[0] != '\0') {
+    location.append("/").append(urlSuffix);
+  }
+  snprintf((char *) fResponseBuffer, sizeof fResponseBuffer,
+           "RTSP/1.0 302 Moved Temporarily\r\n"
+           "CSeq: %s\r\n"
+           "%s"
+           "Location: %s\r\n\r\n",
+           fCurrentCSeq, dateHeader(), location.c_str());
+}
+
+LiveRTSPServer::LiveRTSPClientSession::LiveRTSPClientSession(LiveRTSPServer &ourServer,
+                                                             u_int32_t sessionId)
+    : RTSPClientSession(ourServer, sessionId),
+      server_(ourServer) {}
+
+LiveRTSPServer::LiveRTSPClientSession::~LiveRTSPClientSession() {
+  server_.envir().taskScheduler().unscheduleDelayedTask(delete_task_);
+}
+
+// static
+void LiveRTSPServer::LiveRTSPClientSession::deleteRefused(void *clientData) {
+  auto that = static_cast<LiveRTSPClientSession *>(clientData);
+  that->delete_task_ = nullptr;
+  LOG(INFO) << __func__ << ",session[" << that->fOurSessionId << "]";
+  delete that;
+}
+
+void LiveRTSPServer::LiveRTSPClientSession::handleCmd_SETUP(RTSPClientConnection *ourClientConnection,
+                                                            char const *urlPreSuffix,
+                                                            char const *urlSuffix,
+                                                            char const *fullRequestStr) {
+  // Only the first SETUP opens a session, later ones add tracks to it.
+  if (!admitted_setup_ && !server_.CanAdmit()) {
+    LOG(WARNING) << __func__ << ",refuse new session[" << fOurSessionId << "]";
+    static_cast<LiveRTSPClientConnection *>(ourClientConnection)->RespondOverloaded(urlPreSuffix,
+                                                                                    urlSuffix);
+    // handleRequestBytes() still uses this session after we return, so it
+    // can not be deleted here. Without this it would wait for the liveness
+    // timeout, and retrying clients would pile up sessions while overloaded.
+    if (!delete_task_) {
+      delete_task_ = server_.envir().taskScheduler().scheduleDelayedTask(0, deleteRefused, this);
+    }
+    return;
+  }
+  if (!admitted_setup_) {
+    admitted_setup_ = true;
+    server_.NoteAdmitted();
+  }
+  RTSPClientSession::handleCmd_SETUP(ourClientConnection, urlPreSuffix, urlSuffix, fullRequestStr);
+}
+}
\ No newline at end of file
@@ -0,0 +1,99 @@
+#ifndef RTSP_SERVER_LIVE_RTSP_SERVER_H_
+#define RTSP_SERVER_LIVE_RTSP_SERVER_H_
+
+#include <deque>
+#include <memory>
+#include <string>
+#include "base/macros.h"
+#include "base/time/time.h"
+#include <liveMedia.hh>
+
+namespace rtsp {
+// When the single MessagePumpLive thread saturates every client degrades at
+// once. LiveRTSPServer stops taking new sessions instead: the first SETUP of
+// a session is answered with "503 Service Unavailable", or redirected to
+// |alternate_server|, while the live thread is overloaded. Only SETUP is
+// gated, a session that got its streams always gets its PLAY, and sessions
+// that are already playing are never touched.
+struct AdmissionPolicy {
+ // MessagePumpLive::LoadStats::utilization above which new sessions are refused.
+ double max_utilization = 0.85;
+ // ...or the delayed task lateness above which they are refused.
+ base::TimeDelta max_lateness = base::TimeDelta::FromMilliseconds(40);
+ // The load window needs a few seconds to show a new session's cost, so a
+ // burst of SETUPs would all see the idle load. Each session admitted within
+ // |settle_time| is charged |session_cost| of utilization on top of the
+ // measured load.
+ double session_cost = 0.05;
+ base::TimeDelta settle_time = base::TimeDelta::FromSeconds(3);
+ // "rtsp://host:port" to redirect refused clients to; empty answers 503.
+ std::string alternate_server;
+ // Seconds sent in the 503 "Retry-After" header.
+ unsigned retry_after = 5;
+};
+
+class LiveRTSPServer : public RTSPServer {
+public:
+ static LiveRTSPServer *createNew(UsageEnvironment &env,
+                                  Port ourPort,
+                                  UserAuthenticationDatabase *authDatabase,
+                                  const AdmissionPolicy &policy,
+                                  unsigned reclamationSeconds = 65);
+ const AdmissionPolicy &policy() const { return policy_; }
+ // True if the live thread has room for another session, counting the
+ // sessions admitted too recently to show in the measured load.
+ bool CanAdmit();
+ // A new session was admitted.
+ void NoteAdmitted();
+protected:
+ LiveRTSPServer(UsageEnvironment &env,
+                int ourSocket,
+                Port ourPort,
+                UserAuthenticationDatabase *authDatabase,
+                const AdmissionPolicy &policy,
+                unsigned reclamationSeconds);
+ ~LiveRTSPServer() override;
+
+ class LiveRTSPClientConnection : public RTSPClientConnection {
+ public:
+  LiveRTSPClientConnection(LiveRTSPServer &ourServer,
+                           int clientSocket,
+                           struct sockaddr_in clientAddr);
+  ~LiveRTSPClientConnection() override;
+  // Answer the current request with 503, or a redirect to the alternate
+  // server for |urlPreSuffix|/|urlSuffix|.
+  void RespondOverloaded(char const *urlPreSuffix, char const *urlSuffix);
+ private:
+  LiveRTSPServer &server_;
+ };
+
+ class LiveRTSPClientSession : public RTSPClientSession {
+ public:
+  LiveRTSPClientSession(LiveRTSPServer &ourServer, u_int32_t sessionId);
+  ~LiveRTSPClientSession() override;
+ protected:
+  void handleCmd_SETUP(RTSPClientConnection *ourClientConnection,
+                       char const *urlPreSuffix,
+                       char const *urlSuffix,
+                       char const *fullRequestStr) override;
+ private:
+  // The refused session has no streams and its id was never sent, it is
+  // deleted once the request that created it has been answered.
+  static void deleteRefused(void *clientData);
+
+  LiveRTSPServer &server_;
+  bool admitted_setup_ = false;
+  TaskToken delete_task_ = nullptr;
+ };
+
+ ClientConnection *createNewClientConnection(int clientSocket,
+                                             struct sockaddr_in clientAddr) override;
+ ClientSession *createNewClientSession(u_int32_t sessionId) override;
+private:
+ AdmissionPolicy policy_;
+ // When the sessions of the last |settle_time| were admitted, oldest first.
+ std::deque<base::TimeTicks> recent_admissions_;
+ DISALLOW_COPY_AND_ASSIGN(LiveRTSPServer);
+};
+}
+#endif //RTSP_SERVER_LIVE_RTSP_SERVER_H_
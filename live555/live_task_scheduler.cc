@@ -0,0 +1,318 @@
+#include "rtsp/base/live_task_scheduler.h"
+#include <errno.h>
+#include <sys/select.h>
+#include <algorithm>
+#include <vector>
+#include "base/logging.h"
+
+#include <HandlerSet.hh>
+
+namespace rtsp {
+namespace {
+constexpr long kMillion = 1000000;
+// Very large "tv_sec" values cause select() to fail, same cap as BasicTaskScheduler.
+constexpr long kMaxSelectSeconds = kMillion;
+// A flow never owes more than this many quanta, one long handler (a
+// DESCRIBE waiting in a nested loop) must not starve it for many rounds.
+constexpr int64_t kMaxDebtQuanta = 4;
+}
+
+LiveTaskScheduler *LiveTaskScheduler::createNew(unsigned maxSchedulerGranularity,
+                                                base::TimeDelta sessionQuantum) {
+  return new LiveTaskScheduler(maxSchedulerGranularity, sessionQuantum);
+}
+
+LiveTaskScheduler::LiveTaskScheduler(unsigned maxSchedulerGranularity,
+                                     base::TimeDelta sessionQuantum)
+    : BasicTaskScheduler(maxSchedulerGranularity),
+      quantum_us_(std::max<int64_t>(sessionQuantum.InMicroseconds(), 1)) {
+  LOG(INFO) << __func__ << ",session quantum[" << quantum_us_ << "us]";
+}
+
+LiveTaskScheduler::~LiveTaskScheduler() = default;
+
+void LiveTaskScheduler::SingleStep(unsigned maxDelayTime) {
+  // Nested run loops (LiveMediaSubSession::WaitCompleted) re-enter here from
+  // inside a handler; socket readiness collected before that is stale.
+  const uint64_t step = ++step_count_;
+
+  fd_set readSet = fReadSet; // make a copy for this select() call
+  fd_set writeSet = fWriteSet; // ditto
+  fd_set exceptionSet = fExceptionSet; // ditto
+
+  struct timeval tv_timeToDelay;
+  if (!session_tokens_.empty()) {
+    // Queued session tasks are already due, only poll the sockets.
+    tv_timeToDelay.tv_sec = 0;
+    tv_timeToDelay.tv_usec = 0;
+  } else {
+    DelayInterval const &timeToDelay = fDelayQueue.timeToNextAlarm();
+    tv_timeToDelay.tv_sec = timeToDelay.seconds();
+    tv_timeToDelay.tv_usec = timeToDelay.useconds();
+    if (tv_timeToDelay.tv_sec > kMaxSelectSeconds) {
+      tv_timeToDelay.tv_sec = kMaxSelectSeconds;
+    }
+    // Also check our "maxDelayTime" parameter (if it's > 0):
+    if (maxDelayTime > 0 &&
+        (tv_timeToDelay.tv_sec > (long) maxDelayTime / kMillion ||
+            (tv_timeToDelay.tv_sec == (long) maxDelayTime / kMillion &&
+                tv_timeToDelay.tv_usec > (long) maxDelayTime % kMillion))) {
+      tv_timeToDelay.tv_sec = maxDelayTime / kMillion;
+      tv_timeToDelay.tv_usec = maxDelayTime % kMillion;
+    }
+  }
+
+  const base::TimeTicks wait_start = base::TimeTicks::Now();
+  int selectResult = select(fMaxNumSockets, &readSet, &writeSet, &exceptionSet, &tv_timeToDelay);
+  wait_time_ += base::TimeTicks::Now() - wait_start;
+  if (selectResult < 0) {
+    if (errno != EINTR && errno != EAGAIN) {
+      // Unexpected error - treat this as fatal:
+      PLOG(ERROR) << __func__ << ",select() failed";
+      internalError();
+    }
+    FD_ZERO(&readSet);
+    FD_ZERO(&writeSet);
+    FD_ZERO(&exceptionSet);
+  }
+
+  // Triggered events of tagged sources become session tasks, so they take
+  // part in this round.
+  handleTriggers();
+
+  std::map<FlowKey, std::vector<ReadySocket>> ready;
+  if (selectResult > 0) {
+    HandlerIterator iter(*fHandlers);
+    HandlerDescriptor *handler;
+    while ((handler = iter.next()) != nullptr) {
+      int sock = handler->socketNum; // alias
+      int resultConditionSet = 0;
+      if (FD_ISSET(sock, &readSet) && FD_ISSET(sock, &fReadSet)/*sanity check*/)
+        resultConditionSet |= SOCKET_READABLE;
+      if (FD_ISSET(sock, &writeSet) && FD_ISSET(sock, &fWriteSet)/*sanity check*/)
+        resultConditionSet |= SOCKET_WRITABLE;
+      if (FD_ISSET(sock, &exceptionSet) && FD_ISSET(sock, &fExceptionSet)/*sanity check*/)
+        resultConditionSet |= SOCKET_EXCEPTION;
+      if ((resultConditionSet & handler->conditionSet) != 0 && handler->handlerProc != nullptr) {
+        ready[flowForSocket(sock)].push_back({sock, resultConditionSet});
+      }
+    }
+  }
+
+  // Every flow with pending work gets one turn, starting after the flow that
+  // was served last so no flow is always first.
+  std::vector<FlowKey> round;
+  for (auto const &it : ready) {
+    round.push_back(it.first);
+  }
+  for (auto const &it : flows_) {
+    if (!it.second.tasks.empty())
+      round.push_back(it.first);
+  }
+  std::sort(round.begin(), round.end());
+  round.erase(std::unique(round.begin(), round.end()), round.end());
+  std::rotate(round.begin(),
+              std::upper_bound(round.begin(), round.end(), last_flow_),
+              round.end());
+
+  for (FlowKey key : round) {
+    std::vector<ReadySocket> sockets;
+    auto ready_it = ready.find(key);
+    if (ready_it != ready.end())
+      sockets.swap(ready_it->second);
+    size_t next_socket = 0;
+
+    flows_[key].deficit += quantum_us_;
+    last_flow_ = key;
+    for (;;) {
+      // Handlers may add or remove flows, look it up again every time.
+      auto flow = flows_.find(key);
+      if (flow == flows_.end())
+        break;
+      if (step != step_count_)
+        next_socket = sockets.size();
+      const bool has_sockets = next_socket < sockets.size();
+      if (!has_sockets && flow->second.tasks.empty()) {
+        // An idle flow keeps no credit.
+        flow->second.deficit = 0;
+        break;
+      }
+      if (flow->second.deficit <= 0)
+        break;
+
+      const base::TimeTicks start = base::TimeTicks::Now();
+      const uint64_t steps_before = step_count_;
+      if (has_sockets) {
+        dispatchSocket(sockets[next_socket++]);
+      } else {
+        SessionTask task = flow->second.tasks.front();
+        flow->second.tasks.pop_front();
+        session_tokens_.erase(task.token);
+        (*task.proc)(task.clientData);
+      }
+      flow = flows_.find(key);
+      if (flow == flows_.end())
+        break;
+      int64_t elapsed = (base::TimeTicks::Now() - start).InMicroseconds();
+      // A nested SingleStep() ran every other flow's work inside this
+      // handler, that time is not this flow's.
+      if (steps_before != step_count_)
+        elapsed = std::min(elapsed, quantum_us_);
+      flow->second.deficit = std::max(flow->second.deficit - elapsed,
+                                      -kMaxDebtQuanta * quantum_us_);
+    }
+  }
+
+  // Keep only flows that still have queued tasks or owe time.
+  for (auto it = flows_.begin(); it != flows_.end();) {
+    if (it->second.tasks.empty() && it->second.deficit >= 0) {
+      it = flows_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  // Also handle any delayed event that may have come due.
+  fDelayQueue.handleAlarm();
+}
+
+base::TimeDelta LiveTaskScheduler::takeWaitTime() {
+  base::TimeDelta wait_time = wait_time_;
+  wait_time_ = base::TimeDelta();
+  return wait_time;
+}
+
+void LiveTaskScheduler::setSocketSession(int socketNum, unsigned sessionId) {
+  socket_sessions_[socketNum] = sessionId;
+}
+
+void LiveTaskScheduler::setClientDataSession(void const *clientData, unsigned sessionId) {
+  client_data_sessions_[clientData] = sessionId;
+}
+
+void LiveTaskScheduler::clearSession(unsigned sessionId) {
+  for (auto it = socket_sessions_.begin(); it != socket_sessions_.end();) {
+    if (it->second == sessionId) {
+      it = socket_sessions_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  for (auto it = client_data_sessions_.begin(); it != client_data_sessions_.end();) {
+    if (it->second == sessionId) {
+      it = client_data_sessions_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+TaskToken LiveTaskScheduler::scheduleDelayedTask(int64_t microseconds, TaskFunc *proc,
+                                                 void *clientData) {
+  if (microseconds <= 0) {
+    auto it = client_data_sessions_.find(clientData);
+    if (it != client_data_sessions_.end())
+      return queueSessionTask(it->second, proc, clientData);
+  }
+  return BasicTaskScheduler::scheduleDelayedTask(microseconds, proc, clientData);
+}
+
+void LiveTaskScheduler::unscheduleDelayedTask(TaskToken &prevTask) {
+  auto it = session_tokens_.find(reinterpret_cast<intptr_t>(prevTask));
+  if (it == session_tokens_.end()) {
+    BasicTaskScheduler::unscheduleDelayedTask(prevTask);
+    return;
+  }
+  auto flow = flows_.find(it->second);
+  if (flow != flows_.end()) {
+    auto &tasks = flow->second.tasks;
+    const intptr_t token = it->first;
+    tasks.erase(std::remove_if(tasks.begin(), tasks.end(),
+                               [token](SessionTask const &task) {
+                                 return task.token == token;
+                               }),
+                tasks.end());
+  }
+  session_tokens_.erase(it);
+  prevTask = nullptr;
+}
+
+void LiveTaskScheduler::setBackgroundHandling(int socketNum, int conditionSet,
+                                              BackgroundHandlerProc *handlerProc,
+                                              void *clientData) {
+  BasicTaskScheduler::setBackgroundHandling(socketNum, conditionSet, handlerProc, clientData);
+  if (conditionSet == 0 || handlerProc == nullptr) {
+    // The fd will be reused by an unrelated connection, which must not
+    // inherit this socket's debt.
+    if (socket_sessions_.erase(socketNum) == 0)
+      flows_.erase(flowForSocket(socketNum));
+  }
+}
+
+void LiveTaskScheduler::moveSocketHandling(int oldSocketNum, int newSocketNum) {
+  BasicTaskScheduler::moveSocketHandling(oldSocketNum, newSocketNum);
+  flows_.erase(-1 - static_cast<FlowKey>(oldSocketNum));
+  auto it = socket_sessions_.find(oldSocketNum);
+  if (it != socket_sessions_.end()) {
+    unsigned sessionId = it->second;
+    socket_sessions_.erase(it);
+    socket_sessions_[newSocketNum] = sessionId;
+  }
+}
+
+LiveTaskScheduler::FlowKey LiveTaskScheduler::flowForSocket(int socketNum) const {
+  auto it = socket_sessions_.find(socketNum);
+  if (it != socket_sessions_.end())
+    return static_cast<FlowKey>(it->second);
+  return -1 - static_cast<FlowKey>(socketNum);
+}
+
+TaskToken LiveTaskScheduler::queueSessionTask(unsigned sessionId, TaskFunc *proc,
+                                              void *clientData) {
+  const intptr_t token = --last_session_token_;
+  const FlowKey key = static_cast<FlowKey>(sessionId);
+  flows_[key].tasks.push_back({token, proc, clientData});
+  session_tokens_[token] = key;
+  return reinterpret_cast<TaskToken>(token);
+}
+
+bool LiveTaskScheduler::dispatchSocket(ReadySocket const &ready) {
+  // The handler set may have changed since select() returned.
+  HandlerIterator iter(*fHandlers);
+  HandlerDescriptor *handler;
+  while ((handler = iter.next()) != nullptr) {
+    if (handler->socketNum == ready.socketNum)
+      break;
+  }
+  if (!handler || !handler->handlerProc ||
+      (ready.conditionSet & handler->conditionSet) == 0) {
+    return false;
+  }
+  fLastHandledSocketNum = ready.socketNum;
+  (*handler->handlerProc)(handler->clientData, ready.conditionSet);
+  return true;
+}
+
+void LiveTaskScheduler::handleTriggers() {
+  if (fTriggersAwaitingHandling == 0)
+    return;
+  EventTriggerId pending = fTriggersAwaitingHandling;
+  fTriggersAwaitingHandling &= ~pending;
+
+  // Trigger i uses mask 0x80000000 >> i, see createEventTrigger().
+  for (unsigned i = 0; i < MAX_NUM_EVENT_TRIGGERS; ++i) {
+    EventTriggerId mask = 0x80000000 >> i;
+    if ((pending & mask) == 0 || fTriggeredEventHandlers[i] == nullptr)
+      continue;
+    void *clientData = fTriggeredEventClientDatas[i];
+    auto it = client_data_sessions_.find(clientData);
+    if (it != client_data_sessions_.end()) {
+      queueSessionTask(it->second, fTriggeredEventHandlers[i], clientData);
+    } else {
+      (*fTriggeredEventHandlers[i])(clientData);
+    }
+    fLastUsedTriggerMask = mask;
+    fLastUsedTriggerNum = i;
+  }
+}
+}
@@ -0,0 +1,95 @@
+#ifndef RTSP_BASE_LIVE_TASK_SCHEDULER_H_
+#define RTSP_BASE_LIVE_TASK_SCHEDULER_H_
+
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include "base/macros.h"
+#include "base/time/time.h"
+
+#include <BasicUsageEnvironment.hh>
+
+namespace rtsp {
+// BasicTaskScheduler dispatches one ready socket per SingleStep() in fd order
+// and one due alarm, so a busy client (TCP interleaved, large frames split
+// into many sendNext() alarms) gets as many turns as it asks for.
+//
+// LiveTaskScheduler groups work into flows and serves them with deficit
+// round-robin: every SingleStep() visits each flow with pending work once
+// and lets it run until it has spent its time quantum. A flow is either an
+// RTSP client session (sockets and zero-delay tasks tagged with its session
+// id) or a single untagged socket, e.g. a connection still in DESCRIBE.
+// Between two turns of any flow the thread runs at most one quantum per
+// other flow plus one overrunning handler, which bounds the jitter a heavy
+// session can impose on the others.
+class LiveTaskScheduler : public BasicTaskScheduler {
+public:
+ static LiveTaskScheduler *createNew(unsigned maxSchedulerGranularity,
+                                     base::TimeDelta sessionQuantum);
+ ~LiveTaskScheduler() override;
+
+ // Made public, MessagePumpLive drives the scheduler one step at a time.
+ void SingleStep(unsigned maxDelayTime = 0) override;
+ // Time spent blocked in select() since the last call.
+ base::TimeDelta takeWaitTime();
+
+ // Charge the work of |socketNum| to |sessionId|.
+ void setSocketSession(int socketNum, unsigned sessionId);
+ // Queue zero-delay tasks scheduled with |clientData| (RTPSink::sendNext,
+ // frame sources) on |sessionId| instead of the shared delay queue.
+ void setClientDataSession(void const *clientData, unsigned sessionId);
+ // Forget every socket and clientData tagged with |sessionId|. Tasks already
+ // queued still run, objects may be shared with other sessions.
+ void clearSession(unsigned sessionId);
+
+ TaskToken scheduleDelayedTask(int64_t microseconds, TaskFunc *proc,
+                               void *clientData) override;
+ void unscheduleDelayedTask(TaskToken &prevTask) override;
+ void setBackgroundHandling(int socketNum, int conditionSet,
+                            BackgroundHandlerProc *handlerProc,
+                            void *clientData) override;
+ void moveSocketHandling(int oldSocketNum, int newSocketNum) override;
+protected:
+ LiveTaskScheduler(unsigned maxSchedulerGranularity,
+                   base::TimeDelta sessionQuantum);
+private:
+ // Sessions use their id, untagged sockets use -1 - socketNum.
+ using FlowKey = int64_t;
+
+ struct ReadySocket {
+  int socketNum;
+  int conditionSet;
+ };
+ struct SessionTask {
+  intptr_t token;
+  TaskFunc *proc;
+  void *clientData;
+ };
+ struct Flow {
+  // Microseconds this flow may still run; negative after an overrun, but
+  // never below a few quanta.
+  int64_t deficit = 0;
+  std::deque<SessionTask> tasks;
+ };
+
+ FlowKey flowForSocket(int socketNum) const;
+ TaskToken queueSessionTask(unsigned sessionId, TaskFunc *proc, void *clientData);
+ bool dispatchSocket(ReadySocket const &ready);
+ void handleTriggers();
+
+ int64_t quantum_us_;
+ std::map<FlowKey, Flow> flows_;
+ std::unordered_map<int, unsigned> socket_sessions_;
+ std::unordered_map<void const *, unsigned> client_data_sessions_;
+ // Queued session tasks by token, to support unscheduleDelayedTask().
+ std::unordered_map<intptr_t, FlowKey> session_tokens_;
+ // Counts down from -1 so it never meets DelayQueue's positive tokens.
+ intptr_t last_session_token_ = 0;
+ FlowKey last_flow_ = INT64_MIN;
+ uint64_t step_count_ = 0;
+ base::TimeDelta wait_time_;
+ DISALLOW_COPY_AND_ASSIGN(LiveTaskScheduler);
+};
+}
+#endif //RTSP_BASE_LIVE_TASK_SCHEDULER_H_
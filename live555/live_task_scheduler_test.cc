@@ -0,0 +1,358 @@
+// Checks LiveTaskScheduler's fairness and its flow bookkeeping.
+//
+// fairness: two heavy sessions, one with a backlog of zero-delay tasks and
+//   one with a socket that stays readable, each burn kHeavyTaskUs per
+//   dispatch. A few light sessions wake up on a timer every kLightIntervalUs
+//   and queue one short zero-delay task, like a frame source handing a frame
+//   to its sink. A light task's wait, from being queued to being dispatched,
+//   must stay within (flows - 1) * quantum + one heavy handler. The same
+//   workload on BasicTaskScheduler is run for comparison: there every light
+//   task waits behind the heavy sessions' backlog.
+// nested: a socket handler that now and then runs a nested SingleStep()
+//   loop, like LiveMediaSubSession::WaitCompleted(), must not be charged for
+//   the whole nested run and be starved for many rounds afterwards.
+// fd reuse: a connection that gets the fd of a closed, indebted socket must
+//   be served on the first step.
+//
+//   live_task_scheduler_test [--seconds=2]
+//
+// Exits with 0 when every check passes.
+
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include "base/at_exit.h"
+#include "base/command_line.h"
+#include "base/macros.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/time/time.h"
+#include "rtsp/base/live_task_scheduler.h"
+#include "rtsp/base/percentile.h"
+
+#include <BasicUsageEnvironment.hh>
+
+namespace rtsp {
+namespace {
+constexpr char kSecondsSwitch[] = "seconds";
+
+constexpr int kLightFlows = 3;
+// The task backlog, the readable socket and the light flows.
+constexpr int kFlows = kLightFlows + 2;
+constexpr int kTaskFlow = 0;
+constexpr int kSocketFlow = 1;
+constexpr int64_t kQuantumUs = 2000;
+constexpr int64_t kHeavyTaskUs = 1500;
+constexpr int64_t kLightTaskUs = 20;
+constexpr int64_t kLightIntervalUs = 10000;
+// Zero-delay tasks the heavy task flow keeps queued, like a sink with many
+// packets to send.
+constexpr int kHeavyBacklog = 16;
+// Timer and preemption noise allowed on top of the bound.
+constexpr int64_t kSlackUs = 1000;
+// A nested run long enough that charging it in full would starve its flow
+// for about a hundred rounds.
+constexpr int64_t kNestedRunUs = 200 * 1000;
+constexpr int kNestedEvery = 50;
+// With the debt capped at a few quanta the flow is back within a few rounds.
+constexpr int64_t kMaxNestedRecoveryUs = 50 * 1000;
+
+struct Flow {
+ TaskScheduler *scheduler = nullptr;
+ char const *stop = nullptr;
+ base::TimeTicks queued;
+ std::vector<int64_t> waits_us;
+};
+
+void Spin(int64_t microseconds) {
+  const base::TimeTicks end =
+      base::TimeTicks::Now() + base::TimeDelta::FromMicroseconds(microseconds);
+  while (base::TimeTicks::Now() < end) {}
+}
+
+void RunHeavyTask(void *clientData) {
+  auto flow = static_cast<Flow *>(clientData);
+  Spin(kHeavyTaskUs);
+  if (!*flow->stop)
+    flow->scheduler->scheduleDelayedTask(0, RunHeavyTask, flow);
+}
+
+// The socket is never read, so it stays readable.
+void HandleHeavySocket(void *clientData, int mask) {
+  Spin(kHeavyTaskUs);
+}
+
+void RunLightTask(void *clientData) {
+  auto flow = static_cast<Flow *>(clientData);
+  flow->waits_us.push_back((base::TimeTicks::Now() - flow->queued).InMicroseconds());
+  Spin(kLightTaskUs);
+}
+
+void WakeLightFlow(void *clientData) {
+  auto flow = static_cast<Flow *>(clientData);
+  if (*flow->stop)
+    return;
+  flow->queued = base::TimeTicks::Now();
+  flow->scheduler->scheduleDelayedTask(0, RunLightTask, flow);
+  flow->scheduler->scheduleDelayedTask(kLightIntervalUs, WakeLightFlow, flow);
+}
+
+void StopRun(void *clientData) {
+  *static_cast<char *>(clientData) = 1;
+}
+
+// A readable socket: |fds[0]| has a byte pending that nobody reads.
+bool MakeReadableSocket(int fds[2]) {
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    perror("socketpair");
+    return false;
+  }
+  const char byte = 0;
+  return write(fds[1], &byte, 1) == 1;
+}
+
+void CloseSocket(int fds[2]) {
+  close(fds[0]);
+  close(fds[1]);
+}
+
+struct RunResult {
+ int64_t p99_us = 0;
+ int64_t max_us = 0;
+ size_t dispatches = 0;
+};
+
+// Runs the fairness workload for |duration| and returns the light flows'
+// waits. |live| is non-null when |scheduler| is a LiveTaskScheduler.
+bool RunWorkload(TaskScheduler *scheduler, LiveTaskScheduler *live,
+                 base::TimeDelta duration, RunResult *result) {
+  int fds[2];
+  if (!MakeReadableSocket(fds))
+    return false;
+
+  char stop = 0;
+  Flow flows[kFlows];
+  for (int i = 0; i < kFlows; ++i) {
+    flows[i].scheduler = scheduler;
+    flows[i].stop = &stop;
+    if (live)
+      live->setClientDataSession(&flows[i], static_cast<unsigned>(i + 1));
+  }
+  if (live)
+    live->setSocketSession(fds[0], static_cast<unsigned>(kSocketFlow + 1));
+  scheduler->setBackgroundHandling(fds[0], SOCKET_READABLE, HandleHeavySocket,
+                                   &flows[kSocketFlow]);
+  for (int i = 0; i < kHeavyBacklog; ++i)
+    scheduler->scheduleDelayedTask(0, RunHeavyTask, &flows[kTaskFlow]);
+  for (int i = kSocketFlow + 1; i < kFlows; ++i)
+    scheduler->scheduleDelayedTask(i * kLightIntervalUs / kFlows, WakeLightFlow, &flows[i]);
+  scheduler->scheduleDelayedTask(duration.InMicroseconds(), StopRun, &stop);
+  scheduler->doEventLoop(&stop);
+
+  // Tasks still queued reference |flows|, drain them before returning.
+  scheduler->disableBackgroundHandling(fds[0]);
+  char drained = 0;
+  scheduler->scheduleDelayedTask(100 * 1000, StopRun, &drained);
+  scheduler->doEventLoop(&drained);
+  if (live) {
+    for (int i = 0; i < kFlows; ++i)
+      live->clearSession(static_cast<unsigned>(i + 1));
+  }
+  CloseSocket(fds);
+
+  std::vector<int64_t> waits;
+  for (int i = kSocketFlow + 1; i < kFlows; ++i)
+    waits.insert(waits.end(), flows[i].waits_us.begin(), flows[i].waits_us.end());
+  result->p99_us = Percentile(waits, 0.99);
+  result->max_us = Percentile(waits, 1.0);
+  result->dispatches = waits.size();
+  return true;
+}
+
+bool CheckFairness(base::TimeDelta duration) {
+  // No timers of its own, maxSchedulerGranularity 0 skips the tick task.
+  TaskScheduler *basic = BasicTaskScheduler::createNew(0);
+  RunResult basic_result;
+  bool ran = RunWorkload(basic, nullptr, duration, &basic_result);
+  delete basic;
+
+  LiveTaskScheduler *live = LiveTaskScheduler::createNew(
+      0, base::TimeDelta::FromMicroseconds(kQuantumUs));
+  RunResult live_result;
+  ran = ran && RunWorkload(live, live, duration, &live_result);
+  delete live;
+  if (!ran)
+    return false;
+
+  const int64_t bound_us = (kFlows - 1) * kQuantumUs + kHeavyTaskUs;
+  printf("fairness: light task wait, %d flows, quantum %lldus, heavy handler %lldus, bound %lldus\n",
+         kFlows, (long long) kQuantumUs, (long long) kHeavyTaskUs, (long long) bound_us);
+  printf("  BasicTaskScheduler  p99 %lldus  max %lldus  (%zu dispatches)\n",
+         (long long) basic_result.p99_us, (long long) basic_result.max_us,
+         basic_result.dispatches);
+  printf("  LiveTaskScheduler   p99 %lldus  max %lldus  (%zu dispatches)\n",
+         (long long) live_result.p99_us, (long long) live_result.max_us,
+         live_result.dispatches);
+
+  bool ok = true;
+  if (live_result.dispatches == 0 || live_result.p99_us > bound_us + kSlackUs) {
+    printf("FAIL: LiveTaskScheduler p99 wait exceeds the bound\n");
+    ok = false;
+  }
+  if (basic_result.p99_us <= live_result.p99_us) {
+    printf("FAIL: the workload does not show BasicTaskScheduler's delay\n");
+    ok = false;
+  }
+  return ok;
+}
+
+struct NestedFlow {
+ LiveTaskScheduler *scheduler = nullptr;
+ bool in_nested = false;
+ int dispatches = 0;
+ // When the last nested run returned, null once the flow was served again.
+ base::TimeTicks nested_end;
+ int64_t max_recovery_us = 0;
+ int nested_runs = 0;
+};
+
+void HandleNestedSocket(void *clientData, int mask) {
+  auto flow = static_cast<NestedFlow *>(clientData);
+  // The socket stays readable, the nested loop dispatches it again.
+  if (flow->in_nested)
+    return;
+  const base::TimeTicks now = base::TimeTicks::Now();
+  if (!flow->nested_end.is_null()) {
+    flow->max_recovery_us = std::max(flow->max_recovery_us,
+                                     (now - flow->nested_end).InMicroseconds());
+    flow->nested_end = base::TimeTicks();
+  }
+  if (++flow->dispatches % kNestedEvery != 0) {
+    Spin(kLightTaskUs);
+    return;
+  }
+  flow->in_nested = true;
+  const base::TimeTicks end = now + base::TimeDelta::FromMicroseconds(kNestedRunUs);
+  while (base::TimeTicks::Now() < end)
+    flow->scheduler->SingleStep(1000);
+  flow->in_nested = false;
+  flow->nested_end = base::TimeTicks::Now();
+  ++flow->nested_runs;
+}
+
+bool CheckNestedCharge(base::TimeDelta duration) {
+  LiveTaskScheduler *live = LiveTaskScheduler::createNew(
+      0, base::TimeDelta::FromMicroseconds(kQuantumUs));
+  int fds[2];
+  if (!MakeReadableSocket(fds)) {
+    delete live;
+    return false;
+  }
+  char stop = 0;
+  Flow heavy;
+  heavy.scheduler = live;
+  heavy.stop = &stop;
+  live->setClientDataSession(&heavy, 1);
+  for (int i = 0; i < kHeavyBacklog; ++i)
+    live->scheduleDelayedTask(0, RunHeavyTask, &heavy);
+
+  NestedFlow nested;
+  nested.scheduler = live;
+  live->setSocketSession(fds[0], 2);
+  live->setBackgroundHandling(fds[0], SOCKET_READABLE, HandleNestedSocket, &nested);
+  live->scheduleDelayedTask(duration.InMicroseconds(), StopRun, &stop);
+  live->doEventLoop(&stop);
+
+  live->disableBackgroundHandling(fds[0]);
+  char drained = 0;
+  live->scheduleDelayedTask(100 * 1000, StopRun, &drained);
+  live->doEventLoop(&drained);
+  delete live;
+  CloseSocket(fds);
+
+  printf("nested: %d nested runs of %lldus, longest wait afterwards %lldus, bound %lldus\n",
+         nested.nested_runs, (long long) kNestedRunUs, (long long) nested.max_recovery_us,
+         (long long) kMaxNestedRecoveryUs);
+  if (nested.nested_runs == 0 || nested.max_recovery_us > kMaxNestedRecoveryUs) {
+    printf("FAIL: a flow that ran a nested loop was starved afterwards\n");
+    return false;
+  }
+  return true;
+}
+
+struct Dispatches {
+ int count = 0;
+ int64_t spin_us = 0;
+};
+
+void HandleCountedSocket(void *clientData, int mask) {
+  auto dispatches = static_cast<Dispatches *>(clientData);
+  ++dispatches->count;
+  Spin(dispatches->spin_us);
+}
+
+bool CheckFdReuse() {
+  LiveTaskScheduler *live = LiveTaskScheduler::createNew(
+      0, base::TimeDelta::FromMicroseconds(kQuantumUs));
+  int fds[2];
+  if (!MakeReadableSocket(fds)) {
+    delete live;
+    return false;
+  }
+  // An untagged socket whose one long dispatch leaves its flow in debt.
+  Dispatches first;
+  first.spin_us = kNestedRunUs / 10;
+  live->setBackgroundHandling(fds[0], SOCKET_READABLE, HandleCountedSocket, &first);
+  live->SingleStep(1000);
+  live->disableBackgroundHandling(fds[0]);
+  const int old_fd = fds[0];
+  CloseSocket(fds);
+
+  bool ok = true;
+  if (!MakeReadableSocket(fds)) {
+    delete live;
+    return false;
+  }
+  if (fds[0] != old_fd && fds[1] != old_fd) {
+    printf("fd reuse: the fd was not reused, skipped\n");
+  } else {
+    const int fd = fds[0] == old_fd ? fds[0] : fds[1];
+    if (fd == fds[1]) {
+      const char byte = 0;
+      ok = write(fds[0], &byte, 1) == 1;
+    }
+    Dispatches second;
+    live->setBackgroundHandling(fd, SOCKET_READABLE, HandleCountedSocket, &second);
+    live->SingleStep(1000);
+    live->disableBackgroundHandling(fd);
+    printf("fd reuse: first step dispatched the new connection %d time(s)\n", second.count);
+    if (first.count != 1 || second.count != 1) {
+      printf("FAIL: the new connection inherited the closed socket's debt\n");
+      ok = false;
+    }
+  }
+  CloseSocket(fds);
+  delete live;
+  return ok;
+}
+}
+}
+
+int main(int argc, char *argv[]) {
+  base::AtExitManager at_exit;
+  base::CommandLine::Init(argc, argv);
+  const base::CommandLine *command_line = base::CommandLine::ForCurrentProcess();
+  int seconds = 2;
+  if (command_line->HasSwitch(rtsp::kSecondsSwitch) &&
+      !base::StringToInt(command_line->GetSwitchValueASCII(rtsp::kSecondsSwitch), &seconds)) {
+    fprintf(stderr, "usage: %s [--seconds=N]\n", argv[0]);
+    return 2;
+  }
+  const base::TimeDelta duration = base::TimeDelta::FromSeconds(seconds);
+  bool ok = rtsp::CheckFairness(duration);
+  ok = rtsp::CheckNestedCharge(duration) && ok;
+  ok = rtsp::CheckFdReuse() && ok;
+  printf(ok ? "PASS\n" : "FAIL\n");
+  return ok ? 0 : 1;
+}
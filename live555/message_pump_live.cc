@@ -3,26 +3,36 @@
 #include "base/files/file_util.h"
 #include "base/lazy_instance.h"
 #include <unistd.h>
+#include <algorithm>
 
 namespace rtsp {
 namespace {
 //Live555默认是10ms，在空闲时候也有明显的CPU消耗，我们改成5分钟
 constexpr int64_t kMaxSchedulerGranularity = 300 * 1000000;  //五分钟
+//每个会话每轮最多占用的时间片，防止单个会话拖慢其他会话
+constexpr base::TimeDelta kSessionQuantum = base::TimeDelta::FromMilliseconds(2);
+//负载统计窗口
+constexpr base::TimeDelta kLoadWindow = base::TimeDelta::FromSeconds(1);
 
 namespace {
 class BasicUsageEnvironmentHolder {
 public:
  BasicUsageEnvironmentHolder()
-     : env_(nullptr) {}
+     : env_(nullptr), pump_(nullptr) {}
  ~BasicUsageEnvironmentHolder() = default;
- void Set(UsageEnvironment *env) {
+ void Set(UsageEnvironment *env, MessagePumpLive *pump) {
    env_ = env;
+   pump_ = pump;
  }
  UsageEnvironment *Get() {
    return env_;
  }
+ MessagePumpLive *pump() {
+   return pump_;
+ }
 private:
  UsageEnvironment *env_;
+ MessagePumpLive *pump_;
  DISALLOW_COPY_AND_ASSIGN(BasicUsageEnvironmentHolder);
 };
 
@@ -83,13 +93,13 @@ MessagePumpLive::MessagePumpLive()
     : state_(nullptr),
       wakeup_pipe_read_(-1),
       wakeup_pipe_write_(-1),
-      scheduler_(BasicTaskScheduler::createNew(kMaxSchedulerGranularity)),
+      scheduler_(LiveTaskScheduler::createNew(kMaxSchedulerGranularity, kSessionQuantum)),
       env_(BasicUsageEnvironment::createNew(*scheduler_)) {
   LOG(INFO) << __func__;
   if (!Init()) {
     NOTREACHED();
   } else {
-    g_live555_initializer.Get().Set(env_);
+    g_live555_initializer.Get().Set(env_, this);
     scheduler_->setBackgroundHandling(wakeup_pipe_read_,
                                       SOCKET_READABLE,
                                       &MessagePumpLive::OnWakeUp, this);
@@ -110,7 +120,7 @@ MessagePumpLive::~MessagePumpLive() {
     if (IGNORE_EINTR(close(wakeup_pipe_write_)) < 0)
       DPLOG(ERROR) << "close";
   }
-  g_live555_initializer.Get().Set(nullptr);
+  g_live555_initializer.Get().Set(nullptr, nullptr);
 
   if (env_) {
     const Boolean result = env_->reclaim();
@@ -145,6 +155,8 @@ void MessagePumpLive::Run(Delegate *delegate) {
 void MessagePumpLive::DoRunLoop() {
   LOG(INFO) << __func__;
   for (;;) {
+    UpdateLoad(base::TimeTicks::Now());
+
     bool did_work = state_->delegate->DoWork();
     if (state_->should_quit)
       break;
@@ -153,7 +165,7 @@ void MessagePumpLive::DoRunLoop() {
     if (state_->should_quit)
       break;
 
-    reinterpret_cast<BasicTaskScheduler0 *>(scheduler_.get())->SingleStep(1);
+    scheduler_->SingleStep(1);
     did_work |= processed_io_events_;
     processed_io_events_ = false;
     if (state_->should_quit)
@@ -171,13 +183,13 @@ void MessagePumpLive::DoRunLoop() {
 
     if (delayed_work_time_.is_null()) {
       //LOG(INFO) << __func__ << ",enter live555 internal loop";
-      reinterpret_cast<BasicTaskScheduler0 *>(scheduler_.get())->SingleStep();
+      scheduler_->SingleStep();
       //LOG(INFO) << __func__ << ",leave live555 internal loop";
     } else {
       base::TimeDelta delay = delayed_work_time_ - base::TimeTicks::Now();
       if (delay > base::TimeDelta()) {
         //LOG(INFO) << __func__ << ",enter live555 internal delayed loop,delay[" << delay.InMicroseconds() << "]";
-        reinterpret_cast<BasicTaskScheduler0 *>(scheduler_.get())->SingleStep(delay.InMicroseconds());
+        scheduler_->SingleStep(delay.InMicroseconds());
         //LOG(INFO) << __func__ << ",leave live555 internal delayed loop";
       }
     }
@@ -187,6 +199,33 @@ void MessagePumpLive::DoRunLoop() {
   }
 }
 
+void MessagePumpLive::UpdateLoad(base::TimeTicks now) {
+  load_window_idle_ += scheduler_->takeWaitTime();
+  if (!delayed_work_time_.is_null() && now > delayed_work_time_) {
+    load_window_lateness_ = std::max(load_window_lateness_, now - delayed_work_time_);
+  }
+  if (load_window_start_.is_null()) {
+    load_window_start_ = now;
+    load_window_idle_ = base::TimeDelta();
+    return;
+  }
+  base::TimeDelta elapsed = now - load_window_start_;
+  if (elapsed < kLoadWindow)
+    return;
+
+  double busy = 1.0 - load_window_idle_.InMicrosecondsF() / elapsed.InMicrosecondsF();
+  busy = std::min(1.0, std::max(0.0, busy));
+  // Halve the weight of older windows, one busy second does not trip admission.
+  load_.utilization = (load_.utilization + busy) / 2;
+  load_.max_lateness = load_window_lateness_;
+  DVLOG(1) << __func__ << ",utilization[" << load_.utilization
+           << "],max lateness[" << load_.max_lateness.InMicroseconds() << "us]";
+
+  load_window_start_ = now;
+  load_window_idle_ = base::TimeDelta();
+  load_window_lateness_ = base::TimeDelta();
+}
+
 void MessagePumpLive::Quit() {
   LOG(INFO) << __func__;
   if (state_) {
@@ -203,6 +242,16 @@ UsageEnvironment *MessagePumpLive::env() {
   return g_live555_initializer.Get().Get();
 }
 
+LiveTaskScheduler *MessagePumpLive::scheduler() {
+  UsageEnvironment *env = g_live555_initializer.Get().Get();
+  return env ? static_cast<LiveTaskScheduler *>(&env->taskScheduler()) : nullptr;
+}
+
+MessagePumpLive::LoadStats MessagePumpLive::load() {
+  MessagePumpLive *pump = g_live555_initializer.Get().pump();
+  return pump ? pump->load_ : LoadStats();
+}
+
 void MessagePumpLive::ScheduleWork() {
   //LOG(INFO) << __func__;
   char buf = 0;
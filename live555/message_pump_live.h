@@ -6,12 +6,22 @@
 #include "base/macros.h"
 #include "build/build_config.h"
 #include "base/message_loop/message_pump.h"
+#include "rtsp/base/live_task_scheduler.h"
 
 #include <BasicUsageEnvironment.hh>
 
 namespace rtsp {
 class MessagePumpLive : public base::MessagePump {
 public:
+ // How loaded the live thread is, measured by DoRunLoop over a fixed window.
+ struct LoadStats {
+  // Share of wall time spent running work rather than waiting in select(),
+  // smoothed across windows, 0..1.
+  double utilization = 0;
+  // Worst delay between a Chromium delayed task becoming due and the loop
+  // getting to it, in the last complete window.
+  base::TimeDelta max_lateness;
+ };
  MessagePumpLive();
  virtual ~MessagePumpLive();
  void Run(Delegate *delegate) override;
@@ -19,10 +29,14 @@ public:
  void ScheduleWork() override;
  void ScheduleDelayedWork(const base::TimeTicks &delayed_work_time) override;
  static UsageEnvironment *env();
+ static LiveTaskScheduler *scheduler();
+ // Load of the live thread's pump; call on the live thread.
+ static LoadStats load();
 private:
  bool Init();
  static void OnWakeUp(void *clientData, int mask);
  void DoRunLoop();
+ void UpdateLoad(base::TimeTicks now);
  // We may make recursive calls to Run, so we save state that needs to be
  // separate between them in this structure type.
  struct RunState;
@@ -34,7 +48,11 @@ private:
  int wakeup_pipe_read_;
  int wakeup_pipe_write_;
  bool processed_io_events_ = false;
- std::unique_ptr<TaskScheduler> scheduler_;
+ LoadStats load_;
+ base::TimeTicks load_window_start_;
+ base::TimeDelta load_window_idle_;
+ base::TimeDelta load_window_lateness_;
+ std::unique_ptr<LiveTaskScheduler> scheduler_;
  UsageEnvironment *env_;
  DISALLOW_COPY_AND_ASSIGN(MessagePumpLive);
 };
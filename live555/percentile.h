@@ -0,0 +1,20 @@
+#ifndef RTSP_BASE_PERCENTILE_H_
+#define RTSP_BASE_PERCENTILE_H_
+
+#include <stddef.h>
+#include <algorithm>
+#include <vector>
+
+namespace rtsp {
+// The |percentile| (0..1) of |values| by nearest rank, 0 if there are none.
+// For the load and scheduler test reports.
+template <typename T>
+T Percentile(std::vector<T> values, double percentile) {
+  if (values.empty())
+    return T();
+  std::sort(values.begin(), values.end());
+  size_t index = static_cast<size_t>(percentile * (values.size() - 1) + 0.5);
+  return values[std::min(index, values.size() - 1)];
+}
+}
+#endif //RTSP_BASE_PERCENTILE_H_
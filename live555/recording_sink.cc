@@ -0,0 +1,363 @@
+#include "rtsp/server/recording_sink.h"
+#include "base/logging.h"
+#include "base/strings/stringprintf.h"
+#include <string.h>
+#include <algorithm>
+
+namespace rtsp {
+namespace {
+constexpr size_t kTsPacketSize = 188;
+constexpr size_t kTsPayloadSize = 184;
+// The first packet of an access unit carries an adaptation field with PCR.
+constexpr size_t kTsFirstPayloadSize = kTsPayloadSize - 8;
+constexpr uint16_t kPmtPid = 0x1000;
+constexpr uint16_t kVideoPid = 0x100;
+constexpr uint8_t kStreamTypeH264 = 0x1b;
+constexpr uint8_t kStreamTypeH265 = 0x24;
+// PTS runs this far ahead of PCR, the 0.7s ffmpeg uses by default.
+constexpr int64_t kMuxDelay = 63000;
+constexpr int64_t kClockMask = (int64_t(1) << 33) - 1;
+constexpr unsigned kMaxFrameSize = 1920 * 1080 * 2;
+constexpr base::TimeDelta kStatsInterval = base::TimeDelta::FromSeconds(10);
+
+const uint8_t kStartCode[] = {0x00, 0x00, 0x00, 0x01};
+const uint8_t kH264Aud[] = {0x00, 0x00, 0x00, 0x01, 0x09, 0xf0};
+const uint8_t kH265Aud[] = {0x00, 0x00, 0x00, 0x01, 0x46, 0x01, 0x50};
+
+// CRC-32/MPEG-2 of the PSI sections, only run for PAT/PMT.
+uint32_t Crc32Mpeg2(const uint8_t *data, size_t size) {
+  uint32_t crc = 0xffffffff;
+  for (size_t i = 0; i < size; ++i) {
+    crc ^= static_cast<uint32_t>(data[i]) << 24;
+    for (int bit = 0; bit < 8; ++bit)
+      crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+  }
+  return crc;
+}
+
+// Build a single-packet PSI section: |section| holds the bytes from
+// table_id up to, not including, the CRC.
+void BuildPsiPacket(uint8_t *packet, uint16_t pid, uint8_t continuity,
+                    const uint8_t *section, size_t size) {
+  memset(packet, 0xff, kTsPacketSize);
+  packet[0] = 0x47;
+  packet[1] = 0x40 | (pid >> 8);
+  packet[2] = pid & 0xff;
+  packet[3] = 0x10 | (continuity & 0x0f);
+  packet[4] = 0;  // pointer_field
+  memcpy(packet + 5, section, size);
+  uint32_t crc = Crc32Mpeg2(section, size);
+  packet[5 + size] = crc >> 24;
+  packet[6 + size] = crc >> 16;
+  packet[7 + size] = crc >> 8;
+  packet[8 + size] = crc;
+}
+}
+
+RecordingSink *RecordingSink::createNew(UsageEnvironment &env,
+                                        AVCodecID av_codec_id,
+                                        const RecordingOptions &options) {
+  auto writer = std::make_unique<RecordingWriter>("RecordingWriter");
+  if (!writer->Start()) {
+    LOG(ERROR) << __func__ << ",can not start writer thread";
+    return nullptr;
+  }
+  return new RecordingSink(env, av_codec_id, options, std::move(writer));
+}
+
+RecordingSink::RecordingSink(UsageEnvironment &env,
+                             AVCodecID av_codec_id,
+                             const RecordingOptions &options,
+                             std::unique_ptr<RecordingWriter> writer)
+    : MediaSink(env),
+      av_codec_id_(av_codec_id),
+      options_(options),
+      writer_(std::move(writer)),
+      frame_buffer_(new uint8_t[kMaxFrameSize]) {
+  LOG(INFO) << __func__ << ",directory[" << options_.directory.value()
+            << "],segment[" << options_.segment_duration.InSeconds() << "s]";
+}
+
+RecordingSink::~RecordingSink() {
+  LOG(INFO) << __func__;
+  stopPlaying();
+  endAccessUnit();
+  flushBuffer();
+  reportStats(base::TimeTicks::Now());
+  // Joining the writer waits for the queued buffers to reach the disk, never
+  // do that on the live thread.
+  RecordingWriter::DeleteSoon(std::move(writer_));
+}
+
+Boolean RecordingSink::continuePlaying() {
+  if (!fSource)
+    return False;
+  fSource->getNextFrame(frame_buffer_.get(), kMaxFrameSize,
+                        afterGettingFrame, this,
+                        onSourceClosure, this);
+  return True;
+}
+
+void RecordingSink::afterGettingFrame(void *clientData, unsigned frameSize,
+                                      unsigned numTruncatedBytes,
+                                      struct timeval presentationTime,
+                                      unsigned durationInMicroseconds) {
+  auto that = static_cast<RecordingSink *>(clientData);
+  that->afterGettingFrame1(frameSize, numTruncatedBytes, presentationTime);
+}
+
+void RecordingSink::afterGettingFrame1(unsigned frameSize, unsigned numTruncatedBytes,
+                                       struct timeval presentationTime) {
+  base::TimeTicks start = base::TimeTicks::Now();
+  if (stats_start_.is_null())
+    stats_start_ = start;
+
+  if (numTruncatedBytes > 0) {
+    LOG(WARNING) << __func__ << ",drop truncated NAL unit,size[" << frameSize + numTruncatedBytes << "]";
+    dropped_bytes_ += frameSize + numTruncatedBytes;
+  } else if (frameSize > 0) {
+    handleNalUnit(frame_buffer_.get(), frameSize, presentationTime);
+  }
+
+  base::TimeTicks now = base::TimeTicks::Now();
+  stats_live_time_ += now - start;
+  ++stats_frames_;
+  stats_bytes_ += frameSize;
+  if (now - stats_start_ >= kStatsInterval)
+    reportStats(now);
+
+  continuePlaying();
+}
+
+void RecordingSink::handleNalUnit(const uint8_t *nal, size_t size,
+                                  struct timeval presentationTime) {
+  if (!has_origin_) {
+    origin_ = presentationTime;
+    has_origin_ = true;
+  }
+  if (in_access_unit_ &&
+      (presentationTime.tv_sec != access_unit_time_.tv_sec ||
+          presentationTime.tv_usec != access_unit_time_.tv_usec)) {
+    endAccessUnit();
+  }
+  // We write our own delimiter at the start of every access unit.
+  if (isAccessUnitDelimiter(nal))
+    return;
+  if (!in_access_unit_) {
+    in_access_unit_ = true;
+    access_unit_time_ = presentationTime;
+    access_unit_key_ = false;
+    access_unit_data_.clear();
+  }
+  // SEI and parameter sets may come first, and may also precede non-IDR
+  // pictures: only the slices decide whether this is a key frame.
+  if (isRandomAccessSlice(nal))
+    access_unit_key_ = true;
+  access_unit_data_.insert(access_unit_data_.end(), kStartCode, kStartCode + sizeof(kStartCode));
+  access_unit_data_.insert(access_unit_data_.end(), nal, nal + size);
+}
+
+bool RecordingSink::isAccessUnitDelimiter(const uint8_t *nal) const {
+  if (av_codec_id_ == AV_CODEC_ID_HEVC)
+    return ((nal[0] >> 1) & 0x3f) == 35;
+  return (nal[0] & 0x1f) == 9;
+}
+
+bool RecordingSink::isRandomAccessSlice(const uint8_t *nal) const {
+  if (av_codec_id_ == AV_CODEC_ID_HEVC) {
+    int nal_unit_type = (nal[0] >> 1) & 0x3f;
+    // BLA, IDR and CRA: the IRAP slice types.
+    return nal_unit_type >= 16 && nal_unit_type <= 21;
+  }
+  // Coded slice of an IDR picture.
+  return (nal[0] & 0x1f) == 5;
+}
+
+int64_t RecordingSink::clock90k(struct timeval time) const {
+  int64_t us = (static_cast<int64_t>(time.tv_sec) - origin_.tv_sec) * 1000000 +
+      (time.tv_usec - origin_.tv_usec);
+  return us * 9 / 100;
+}
+
+void RecordingSink::endAccessUnit() {
+  if (!in_access_unit_)
+    return;
+  in_access_unit_ = false;
+  access_unit_clock_ = clock90k(access_unit_time_);
+
+  // Segments always start with a key frame, so each one plays on its own.
+  if (access_unit_key_ && (!segment_open_ ||
+      access_unit_clock_ - segment_start_ >= options_.segment_duration.InMicroseconds() * 9 / 100)) {
+    openSegment(access_unit_clock_);
+  }
+  if (!segment_open_)
+    return;
+  if (access_unit_key_)
+    writeTables();
+
+  const int64_t pts = (access_unit_clock_ + kMuxDelay) & kClockMask;
+  const uint8_t pes_header[] = {
+      0x00, 0x00, 0x01, 0xe0,
+      0x00, 0x00,  // PES_packet_length 0, unbounded video PES
+      0x80,  // '10', no scrambling
+      0x80,  // PTS only
+      0x05,
+      static_cast<uint8_t>(0x21 | ((pts >> 29) & 0x0e)),
+      static_cast<uint8_t>(pts >> 22),
+      static_cast<uint8_t>(((pts >> 14) & 0xfe) | 0x01),
+      static_cast<uint8_t>(pts >> 7),
+      static_cast<uint8_t>(((pts << 1) & 0xfe) | 0x01),
+  };
+  first_packet_of_access_unit_ = true;
+  payload_size_ = 0;
+  appendPayload(pes_header, sizeof(pes_header));
+  if (av_codec_id_ == AV_CODEC_ID_HEVC) {
+    appendPayload(kH265Aud, sizeof(kH265Aud));
+  } else {
+    appendPayload(kH264Aud, sizeof(kH264Aud));
+  }
+  appendPayload(access_unit_data_.data(), access_unit_data_.size());
+  if (payload_size_ > 0)
+    emitPayloadPacket();
+}
+
+void RecordingSink::openSegment(int64_t clock) {
+  // What is buffered belongs to the previous segment.
+  flushBuffer();
+  base::Time::Exploded now;
+  base::Time::Now().LocalExplode(&now);
+  std::string name = base::StringPrintf("%s-%04d%02d%02d-%02d%02d%02d-%d.ts",
+                                        options_.prefix.c_str(),
+                                        now.year, now.month, now.day_of_month,
+                                        now.hour, now.minute, now.second,
+                                        segment_index_++);
+  writer_->OpenSegment(options_.directory.AppendASCII(name));
+  segment_open_ = true;
+  segment_start_ = clock;
+}
+
+void RecordingSink::appendPayload(const uint8_t *data, size_t size) {
+  while (size > 0) {
+    size_t capacity = first_packet_of_access_unit_ ? kTsFirstPayloadSize : kTsPayloadSize;
+    size_t n = std::min(capacity - payload_size_, size);
+    memcpy(payload_ + payload_size_, data, n);
+    payload_size_ += n;
+    data += n;
+    size -= n;
+    if (payload_size_ == capacity)
+      emitPayloadPacket();
+  }
+}
+
+void RecordingSink::emitPayloadPacket() {
+  uint8_t packet[kTsPacketSize];
+  const bool first = first_packet_of_access_unit_;
+  packet[0] = 0x47;
+  packet[1] = (first ? 0x40 : 0x00) | (kVideoPid >> 8);
+  packet[2] = kVideoPid & 0xff;
+
+  size_t offset = 4;
+  if (first || payload_size_ < kTsPayloadSize) {
+    packet[3] = 0x30 | (video_continuity_++ & 0x0f);
+    // The adaptation field fills whatever the payload does not.
+    const size_t adaptation_size = kTsPayloadSize - payload_size_;
+    packet[offset++] = static_cast<uint8_t>(adaptation_size - 1);
+    if (adaptation_size > 1) {
+      uint8_t flags = 0;
+      if (first)
+        flags |= 0x10 | (access_unit_key_ ? 0x40 : 0x00);  // PCR, random_access
+      packet[offset++] = flags;
+      if (first) {
+        const int64_t pcr = access_unit_clock_ & kClockMask;
+        packet[offset++] = static_cast<uint8_t>(pcr >> 25);
+        packet[offset++] = static_cast<uint8_t>(pcr >> 17);
+        packet[offset++] = static_cast<uint8_t>(pcr >> 9);
+        packet[offset++] = static_cast<uint8_t>(pcr >> 1);
+        packet[offset++] = static_cast<uint8_t>(((pcr & 1) << 7) | 0x7e);
+        packet[offset++] = 0;
+      }
+      memset(packet + offset, 0xff, 4 + adaptation_size - offset);
+      offset = 4 + adaptation_size;
+    }
+  } else {
+    packet[3] = 0x10 | (video_continuity_++ & 0x0f);
+  }
+  memcpy(packet + offset, payload_, payload_size_);
+  writePacket(packet);
+  payload_size_ = 0;
+  first_packet_of_access_unit_ = false;
+}
+
+void RecordingSink::writeTables() {
+  uint8_t packet[kTsPacketSize];
+  const uint8_t pat[] = {
+      0x00,  // table_id
+      0xb0, 0x0d,  // section_length 13
+      0x00, 0x01,  // transport_stream_id
+      0xc1, 0x00, 0x00,  // version 0, current, section 0 of 0
+      0x00, 0x01,  // program_number 1
+      static_cast<uint8_t>(0xe0 | (kPmtPid >> 8)), static_cast<uint8_t>(kPmtPid & 0xff),
+  };
+  BuildPsiPacket(packet, 0, pat_continuity_++, pat, sizeof(pat));
+  writePacket(packet);
+
+  const uint8_t pmt[] = {
+      0x02,  // table_id
+      0xb0, 0x12,  // section_length 18
+      0x00, 0x01,  // program_number 1
+      0xc1, 0x00, 0x00,  // version 0, current, section 0 of 0
+      static_cast<uint8_t>(0xe0 | (kVideoPid >> 8)), static_cast<uint8_t>(kVideoPid & 0xff),  // PCR_PID
+      0xf0, 0x00,  // program_info_length 0
+      av_codec_id_ == AV_CODEC_ID_HEVC ? kStreamTypeH265 : kStreamTypeH264,
+      static_cast<uint8_t>(0xe0 | (kVideoPid >> 8)), static_cast<uint8_t>(kVideoPid & 0xff),
+      0xf0, 0x00,  // ES_info_length 0
+  };
+  BuildPsiPacket(packet, kPmtPid, pmt_continuity_++, pmt, sizeof(pmt));
+  writePacket(packet);
+}
+
+void RecordingSink::writePacket(const uint8_t *packet) {
+  size_t done = 0;
+  while (done < kTsPacketSize) {
+    if (!buffer_) {
+      buffer_ = writer_->AcquireBuffer();
+      buffer_size_ = 0;
+      if (!buffer_) {
+        // The disk is behind by the whole pool, drop rather than block.
+        dropped_bytes_ += kTsPacketSize - done;
+        return;
+      }
+    }
+    size_t n = std::min(RecordingWriter::kBufferSize - buffer_size_, kTsPacketSize - done);
+    memcpy(buffer_.get() + buffer_size_, packet + done, n);
+    buffer_size_ += n;
+    done += n;
+    if (buffer_size_ == RecordingWriter::kBufferSize)
+      flushBuffer();
+  }
+}
+
+void RecordingSink::flushBuffer() {
+  if (!buffer_)
+    return;
+  writer_->Write(std::move(buffer_), buffer_size_);
+  buffer_size_ = 0;
+}
+
+void RecordingSink::reportStats(base::TimeTicks now) {
+  if (stats_start_.is_null())
+    return;
+  double seconds = (now - stats_start_).InSecondsF();
+  if (seconds <= 0)
+    return;
+  LOG(INFO) << __func__ << ",frames[" << stats_frames_
+            << "],input[" << stats_bytes_ * 8 / seconds / 1e6 << "Mbit/s]"
+            << ",live thread[" << (stats_frames_ ? stats_live_time_.InMicrosecondsF() / stats_frames_ : 0)
+            << "us/frame," << stats_live_time_.InMicrosecondsF() / (seconds * 1e4) << "%]"
+            << ",dropped[" << dropped_bytes_ << "]";
+  stats_start_ = now;
+  stats_live_time_ = base::TimeDelta();
+  stats_frames_ = 0;
+  stats_bytes_ = 0;
+}
+}
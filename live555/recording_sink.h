@@ -0,0 +1,103 @@
+#ifndef RTSP_SERVER_RECORDING_SINK_H_
+#define RTSP_SERVER_RECORDING_SINK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "base/macros.h"
+#include "base/files/file_path.h"
+#include "base/time/time.h"
+#include "media/ffmpeg/ffmpeg_common.h"
+#include "rtsp/server/recording_writer.h"
+#include <liveMedia.hh>
+
+namespace rtsp {
+struct RecordingOptions {
+ base::FilePath directory;
+ std::string prefix = "record";
+ // A new segment starts at the first key frame after this much stream time.
+ base::TimeDelta segment_duration = base::TimeDelta::FromSeconds(60);
+};
+
+// Records the encoded NAL units of a CaptureFramedSource (or any source that
+// delivers one NAL unit per frame, like the RTSP framers expect) as MPEG-TS
+// segments, without decoding or re-encoding. Each access unit is collected,
+// then muxed by copying it into the writer's buffers on the live thread; all
+// file I/O is on RecordingWriter's thread.
+class RecordingSink : public MediaSink {
+public:
+ static RecordingSink *createNew(UsageEnvironment &env,
+                                 AVCodecID av_codec_id,
+                                 const RecordingOptions &options);
+protected:
+ RecordingSink(UsageEnvironment &env,
+               AVCodecID av_codec_id,
+               const RecordingOptions &options,
+               std::unique_ptr<RecordingWriter> writer);
+ ~RecordingSink() override;
+private:
+ Boolean continuePlaying() override;
+ static void afterGettingFrame(void *clientData, unsigned frameSize,
+                               unsigned numTruncatedBytes,
+                               struct timeval presentationTime,
+                               unsigned durationInMicroseconds);
+ void afterGettingFrame1(unsigned frameSize, unsigned numTruncatedBytes,
+                         struct timeval presentationTime);
+ void handleNalUnit(const uint8_t *nal, size_t size, struct timeval presentationTime);
+
+ bool isAccessUnitDelimiter(const uint8_t *nal) const;
+ bool isRandomAccessSlice(const uint8_t *nal) const;
+ // Stream time of |time| in 90kHz units since the first recorded frame.
+ int64_t clock90k(struct timeval time) const;
+
+ // Mux the buffered access unit, opening a segment if it is a key frame.
+ void endAccessUnit();
+ void openSegment(int64_t clock);
+ void appendPayload(const uint8_t *data, size_t size);
+ void emitPayloadPacket();
+ void writeTables();
+ void writePacket(const uint8_t *packet);
+ void flushBuffer();
+ void reportStats(base::TimeTicks now);
+
+ AVCodecID av_codec_id_;
+ RecordingOptions options_;
+ std::unique_ptr<RecordingWriter> writer_;
+ std::unique_ptr<uint8_t[]> frame_buffer_;
+
+ RecordingWriter::Buffer buffer_;
+ size_t buffer_size_ = 0;
+
+ bool segment_open_ = false;
+ int64_t segment_start_ = 0;
+ int segment_index_ = 0;
+ bool has_origin_ = false;
+ struct timeval origin_;
+
+ // The access unit being collected: NAL units sharing one presentation
+ // time, with start codes, muxed once it is complete.
+ bool in_access_unit_ = false;
+ bool access_unit_key_ = false;
+ std::vector<uint8_t> access_unit_data_;
+ struct timeval access_unit_time_;
+ int64_t access_unit_clock_ = 0;
+ bool first_packet_of_access_unit_ = false;
+ uint8_t payload_[184];
+ size_t payload_size_ = 0;
+
+ uint8_t pat_continuity_ = 0;
+ uint8_t pmt_continuity_ = 0;
+ uint8_t video_continuity_ = 0;
+
+ // Live thread cost, reported every few seconds.
+ base::TimeTicks stats_start_;
+ base::TimeDelta stats_live_time_;
+ int64_t stats_frames_ = 0;
+ int64_t stats_bytes_ = 0;
+ int64_t dropped_bytes_ = 0;
+ DISALLOW_COPY_AND_ASSIGN(RecordingSink);
+};
+}
+#endif //RTSP_SERVER_RECORDING_SINK_H_
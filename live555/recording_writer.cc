@@ -0,0 +1,148 @@
+#include "rtsp/server/recording_writer.h"
+#include "base/bind.h"
+#include "base/lazy_instance.h"
+#include "base/logging.h"
+
+namespace rtsp {
+namespace {
+// Page alignment keeps buffers friendly to the page cache and to O_DIRECT.
+constexpr size_t kBufferAlignment = 4096;
+// 16MB queued, about 8 seconds of a 16Mbit/s stream.
+constexpr int kMaxBuffers = 16;
+
+// Destroys finished writers on its own thread, so whoever stops a recording
+// never waits for the disk. Joined at exit, which lets the last segments
+// reach the disk.
+class WriterReaper {
+public:
+ WriterReaper()
+     : thread_("RecordingWriterReaper") {
+   thread_.Start();
+   // Started by the first caller, stopped by the AtExitManager.
+   thread_.DetachFromSequence();
+ }
+ ~WriterReaper() {
+   thread_.Stop();
+ }
+ void Delete(std::unique_ptr<RecordingWriter> writer) {
+   thread_.task_runner()->PostTask(
+       FROM_HERE, base::BindOnce([](std::unique_ptr<RecordingWriter> writer) {},
+                                 std::move(writer)));
+ }
+private:
+ base::Thread thread_;
+ DISALLOW_COPY_AND_ASSIGN(WriterReaper);
+};
+
+base::LazyInstance<WriterReaper>::DestructorAtExit
+    g_writer_reaper = LAZY_INSTANCE_INITIALIZER;
+}
+
+constexpr size_t RecordingWriter::kBufferSize;
+
+RecordingWriter::RecordingWriter(const std::string &name)
+    : thread_(name) {
+  LOG(INFO) << __func__ << "," << name;
+}
+
+RecordingWriter::~RecordingWriter() {
+  LOG(INFO) << __func__ << ",begin";
+  if (thread_.IsRunning()) {
+    thread_.task_runner()->PostTask(
+        FROM_HERE, base::BindOnce(&RecordingWriter::CloseSegmentOnWriterThread,
+                                  base::Unretained(this)));
+    thread_.Stop();
+  }
+  LOG(INFO) << __func__ << ",end";
+}
+
+// static
+void RecordingWriter::DeleteSoon(std::unique_ptr<RecordingWriter> writer) {
+  if (!writer)
+    return;
+  // Stop() is checked against the sequence that started the thread.
+  writer->thread_.DetachFromSequence();
+  g_writer_reaper.Get().Delete(std::move(writer));
+}
+
+bool RecordingWriter::Start() {
+  // Normal priority: a background writer falls behind under load, and the
+  // pool then runs dry and recordings drop data.
+  return thread_.Start();
+}
+
+RecordingWriter::Buffer RecordingWriter::AcquireBuffer() {
+  base::AutoLock auto_lock(lock_);
+  if (!free_buffers_.empty()) {
+    Buffer buffer = std::move(free_buffers_.back());
+    free_buffers_.pop_back();
+    ++in_flight_;
+    return buffer;
+  }
+  if (in_flight_ >= kMaxBuffers)
+    return nullptr;
+  ++in_flight_;
+  return Buffer(static_cast<uint8_t *>(base::AlignedAlloc(kBufferSize, kBufferAlignment)));
+}
+
+void RecordingWriter::OpenSegment(const base::FilePath &path) {
+  thread_.task_runner()->PostTask(
+      FROM_HERE, base::BindOnce(&RecordingWriter::OpenSegmentOnWriterThread,
+                                base::Unretained(this), path));
+}
+
+void RecordingWriter::Write(Buffer buffer, size_t size) {
+  DCHECK_LE(size, kBufferSize);
+  thread_.task_runner()->PostTask(
+      FROM_HERE, base::BindOnce(&RecordingWriter::WriteOnWriterThread,
+                                base::Unretained(this), std::move(buffer), size));
+}
+
+void RecordingWriter::OpenSegmentOnWriterThread(const base::FilePath &path) {
+  CloseSegmentOnWriterThread();
+  file_.Initialize(path, base::File::FLAG_CREATE_ALWAYS | base::File::FLAG_WRITE);
+  if (!file_.IsValid()) {
+    LOG(ERROR) << __func__ << ",can not create " << path.value() << ":"
+               << base::File::ErrorToString(file_.error_details());
+    return;
+  }
+  path_ = path;
+  segment_opened_ = base::TimeTicks::Now();
+  segment_write_time_ = base::TimeDelta();
+  segment_bytes_ = 0;
+  LOG(INFO) << __func__ << "," << path_.value();
+}
+
+void RecordingWriter::WriteOnWriterThread(Buffer buffer, size_t size) {
+  if (file_.IsValid()) {
+    base::TimeTicks start = base::TimeTicks::Now();
+    int written = file_.WriteAtCurrentPos(reinterpret_cast<const char *>(buffer.get()),
+                                          static_cast<int>(size));
+    segment_write_time_ += base::TimeTicks::Now() - start;
+    if (written != static_cast<int>(size)) {
+      PLOG(ERROR) << __func__ << ",short write to " << path_.value();
+    } else {
+      segment_bytes_ += written;
+    }
+  }
+  ReleaseBuffer(std::move(buffer));
+}
+
+void RecordingWriter::CloseSegmentOnWriterThread() {
+  if (!file_.IsValid())
+    return;
+  file_.Close();
+  double seconds = (base::TimeTicks::Now() - segment_opened_).InSecondsF();
+  double write_seconds = segment_write_time_.InSecondsF();
+  LOG(INFO) << __func__ << "," << path_.value() << ",bytes[" << segment_bytes_
+            << "],sustained[" << (seconds > 0 ? segment_bytes_ / seconds / 1e6 : 0)
+            << "MB/s],write()[" << (write_seconds > 0 ? segment_bytes_ / write_seconds / 1e6 : 0)
+            << "MB/s]";
+}
+
+void RecordingWriter::ReleaseBuffer(Buffer buffer) {
+  base::AutoLock auto_lock(lock_);
+  --in_flight_;
+  free_buffers_.push_back(std::move(buffer));
+}
+}
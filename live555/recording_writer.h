@@ -0,0 +1,65 @@
+#ifndef RTSP_SERVER_RECORDING_WRITER_H_
+#define RTSP_SERVER_RECORDING_WRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "base/macros.h"
+#include "base/files/file.h"
+#include "base/files/file_path.h"
+#include "base/memory/aligned_memory.h"
+#include "base/synchronization/lock.h"
+#include "base/threading/thread.h"
+#include "base/time/time.h"
+
+namespace rtsp {
+// Writes recording segments on its own thread so the MessagePumpLive thread
+// only ever copies into memory. Data travels in large page-aligned buffers
+// that are recycled through a small pool; when the disk falls so far behind
+// that the pool is exhausted, AcquireBuffer() fails and the caller drops
+// data instead of waiting.
+class RecordingWriter {
+public:
+ using Buffer = std::unique_ptr<uint8_t, base::AlignedFreeDeleter>;
+ static constexpr size_t kBufferSize = 1024 * 1024;
+
+ explicit RecordingWriter(const std::string &name);
+ // Writes out everything queued, closes the segment and joins the thread,
+ // which can take seconds on a slow disk. The live thread uses DeleteSoon().
+ ~RecordingWriter();
+ // Destroys |writer| on a dedicated reaper thread.
+ static void DeleteSoon(std::unique_ptr<RecordingWriter> writer);
+ bool Start();
+
+ // Called on the producer thread.
+ Buffer AcquireBuffer();
+ // Later Write()s go to |path|, the previous segment is closed.
+ void OpenSegment(const base::FilePath &path);
+ // Queue the first |size| bytes of |buffer|, which returns to the pool once
+ // written.
+ void Write(Buffer buffer, size_t size);
+private:
+ void OpenSegmentOnWriterThread(const base::FilePath &path);
+ void WriteOnWriterThread(Buffer buffer, size_t size);
+ void CloseSegmentOnWriterThread();
+ void ReleaseBuffer(Buffer buffer);
+
+ base::Thread thread_;
+
+ base::Lock lock_;
+ std::vector<Buffer> free_buffers_;
+ // Buffers handed out and not yet written.
+ int in_flight_ = 0;
+
+ // Writer thread only.
+ base::File file_;
+ base::FilePath path_;
+ base::TimeTicks segment_opened_;
+ base::TimeDelta segment_write_time_;
+ int64_t segment_bytes_ = 0;
+ DISALLOW_COPY_AND_ASSIGN(RecordingWriter);
+};
+}
+#endif //RTSP_SERVER_RECORDING_WRITER_H_
@@ -0,0 +1,170 @@
+#include "rtsp/server/replay_framed_source.h"
+#include "base/files/memory_mapped_file.h"
+#include "base/logging.h"
+#include <string.h>
+#include <sys/time.h>
+#include <algorithm>
+
+namespace rtsp {
+namespace {
+// If delivery falls further behind than this (slow sink, debugger) restart
+// pacing from now instead of bursting to catch up.
+constexpr base::TimeDelta kMaxReplayLag = base::TimeDelta::FromSeconds(1);
+
+// Position of the next "00 00 01" at or after |from|, or |length|.
+size_t FindStartCode(const uint8_t *data, size_t length, size_t from) {
+  for (size_t i = from; i + 3 <= length; ++i) {
+    if (data[i + 2] > 1) {
+      i += 2;
+    } else if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+      return i;
+    }
+  }
+  return length;
+}
+}
+
+ReplayFramedSource *ReplayFramedSource::createNew(UsageEnvironment &env,
+                                                  AVCodecID av_codec_id,
+                                                  const ReplayOptions &options) {
+  auto file = std::make_unique<base::MemoryMappedFile>();
+  if (!file->Initialize(options.path) || file->length() == 0) {
+    LOG(ERROR) << __func__ << ",can not map replay file:" << options.path.value();
+    return nullptr;
+  }
+  return new ReplayFramedSource(env, av_codec_id, std::move(file), options);
+}
+
+ReplayFramedSource::ReplayFramedSource(UsageEnvironment &env,
+                                       AVCodecID av_codec_id,
+                                       std::unique_ptr<base::MemoryMappedFile> file,
+                                       const ReplayOptions &options)
+    : FramedSource(env),
+      av_codec_id_(av_codec_id),
+      file_(std::move(file)) {
+  if (options.frame_rate > 0 && options.speed > 0) {
+    frame_interval_ = base::TimeDelta::FromMicrosecondsD(
+        base::Time::kMicrosecondsPerSecond / (options.frame_rate * options.speed));
+  }
+  picture_timestamp_.tv_sec = 0;
+  picture_timestamp_.tv_usec = 0;
+  LOG(INFO) << __func__ << ",file[" << options.path.value() << "],size[" << file_->length()
+            << "],frame interval[" << frame_interval_.InMicroseconds() << "us]";
+}
+
+ReplayFramedSource::~ReplayFramedSource() {
+  LOG(INFO) << __func__;
+  envir().taskScheduler().unscheduleDelayedTask(nextTask());
+}
+
+void ReplayFramedSource::doGetNextFrame() {
+  if (!nextNalUnit(&pending_nal_, &pending_size_)) {
+    LOG(ERROR) << __func__ << ",no NAL unit in replay file";
+    handleClosure();
+    return;
+  }
+
+  int64_t delay = 0;
+  if (startsAccessUnit(pending_nal_, pending_size_)) {
+    pending_new_picture_ = true;
+    base::TimeTicks now = base::TimeTicks::Now();
+    if (next_picture_time_.is_null() || now - next_picture_time_ > kMaxReplayLag)
+      next_picture_time_ = now;
+    delay = std::max<int64_t>(0, (next_picture_time_ - now).InMicroseconds());
+    next_picture_time_ += frame_interval_;
+  }
+  last_was_vcl_ = isVclNalUnit(pending_nal_, pending_size_);
+  // Always go through the scheduler, delivering from doGetNextFrame() would
+  // recurse through the framer and sink for every NAL unit of a picture.
+  nextTask() = envir().taskScheduler().scheduleDelayedTask(delay, deliverFrame0, this);
+}
+
+void ReplayFramedSource::doStopGettingFrames() {
+  envir().taskScheduler().unscheduleDelayedTask(nextTask());
+}
+
+void ReplayFramedSource::deliverFrame0(void *clientData) {
+  static_cast<ReplayFramedSource *>(clientData)->deliverFrame();
+}
+
+void ReplayFramedSource::deliverFrame() {
+  nextTask() = nullptr;
+  if (!isCurrentlyAwaitingData())
+    return;
+
+  // Every NAL unit of a picture carries the time the picture was sent.
+  if (pending_new_picture_) {
+    gettimeofday(&picture_timestamp_, nullptr);
+    pending_new_picture_ = false;
+  }
+  if (pending_size_ > fMaxSize) {
+    fFrameSize = fMaxSize;
+    fNumTruncatedBytes = pending_size_ - fMaxSize;
+  } else {
+    fFrameSize = pending_size_;
+    fNumTruncatedBytes = 0;
+  }
+  memmove(fTo, pending_nal_, fFrameSize);
+  fPresentationTime = picture_timestamp_;
+  fDurationInMicroseconds = 0;
+  FramedSource::afterGetting(this);
+}
+
+bool ReplayFramedSource::nextNalUnit(const uint8_t **nal, size_t *size) {
+  const uint8_t *data = file_->data();
+  const size_t length = file_->length();
+  bool wrapped = false;
+  for (;;) {
+    size_t prefix = FindStartCode(data, length, offset_);
+    if (prefix == length) {
+      if (wrapped)
+        return false;
+      wrapped = true;
+      offset_ = 0;
+      continue;
+    }
+    size_t begin = prefix + 3;
+    size_t end = FindStartCode(data, length, begin);
+    offset_ = end;
+    // Zero bytes before the next start code belong to a 4-byte start code
+    // or are trailing_zero_8bits, not to this NAL unit.
+    while (end > begin && data[end - 1] == 0)
+      --end;
+    if (end > begin) {
+      *nal = data + begin;
+      *size = end - begin;
+      return true;
+    }
+  }
+}
+
+bool ReplayFramedSource::isVclNalUnit(const uint8_t *nal, size_t size) const {
+  if (av_codec_id_ == AV_CODEC_ID_HEVC) {
+    int nal_unit_type = (nal[0] >> 1) & 0x3f;
+    return nal_unit_type < 32;
+  }
+  int nal_unit_type = nal[0] & 0x1f;
+  return nal_unit_type >= 1 && nal_unit_type <= 5;
+}
+
+bool ReplayFramedSource::startsAccessUnit(const uint8_t *nal, size_t size) const {
+  if (!last_was_vcl_)
+    return false;
+  if (av_codec_id_ == AV_CODEC_ID_HEVC) {
+    int nal_unit_type = (nal[0] >> 1) & 0x3f;
+    if (nal_unit_type < 32) {
+      // first_slice_segment_in_pic_flag
+      return size > 2 && (nal[2] & 0x80);
+    }
+    // VPS, SPS, PPS, AUD, prefix SEI.
+    return (nal_unit_type >= 32 && nal_unit_type <= 35) || nal_unit_type == 39;
+  }
+  int nal_unit_type = nal[0] & 0x1f;
+  if (nal_unit_type >= 1 && nal_unit_type <= 5) {
+    // first_mb_in_slice == 0 is coded as a single '1' bit.
+    return size > 1 && (nal[1] & 0x80);
+  }
+  // SEI, SPS, PPS, AUD.
+  return nal_unit_type >= 6 && nal_unit_type <= 9;
+}
+}
@@ -0,0 +1,63 @@
+#ifndef RTSP_SERVER_REPLAY_FRAMED_SOURCE_H_
+#define RTSP_SERVER_REPLAY_FRAMED_SOURCE_H_
+
+#include <memory>
+#include "base/macros.h"
+#include "base/files/file_path.h"
+#include "base/time/time.h"
+#include "media/ffmpeg/ffmpeg_common.h"
+#include <liveMedia.hh>
+
+namespace base {
+class MemoryMappedFile;
+}
+
+namespace rtsp {
+struct ReplayOptions {
+ // Recorded Annex-B H.264/H.265 elementary stream.
+ base::FilePath path;
+ // Frame rate the stream was recorded at.
+ double frame_rate = 25;
+ // Playback speed, 2 replays twice as fast; 0 sends as fast as the sink reads.
+ double speed = 1;
+};
+
+// Stands in for CaptureFramedSource in load tests: replays a memory-mapped
+// elementary stream in a loop, one NAL unit per frame like the encoder does,
+// paced per picture at the recorded frame rate times |speed|.
+class ReplayFramedSource : public FramedSource {
+public:
+ static ReplayFramedSource *createNew(UsageEnvironment &env,
+                                      AVCodecID av_codec_id,
+                                      const ReplayOptions &options);
+protected:
+ ReplayFramedSource(UsageEnvironment &env,
+                    AVCodecID av_codec_id,
+                    std::unique_ptr<base::MemoryMappedFile> file,
+                    const ReplayOptions &options);
+ ~ReplayFramedSource() override;
+private:
+ void doGetNextFrame() override;
+ void doStopGettingFrames() override;
+ static void deliverFrame0(void *clientData);
+ void deliverFrame();
+ // Find the NAL unit at |offset_|, wrapping to the start of the file.
+ bool nextNalUnit(const uint8_t **nal, size_t *size);
+ bool isVclNalUnit(const uint8_t *nal, size_t size) const;
+ bool startsAccessUnit(const uint8_t *nal, size_t size) const;
+
+ AVCodecID av_codec_id_;
+ std::unique_ptr<base::MemoryMappedFile> file_;
+ base::TimeDelta frame_interval_;
+ size_t offset_ = 0;
+ const uint8_t *pending_nal_ = nullptr;
+ size_t pending_size_ = 0;
+ // Treat the first NAL unit as the start of an access unit.
+ bool last_was_vcl_ = true;
+ bool pending_new_picture_ = false;
+ base::TimeTicks next_picture_time_;
+ struct timeval picture_timestamp_;
+ DISALLOW_COPY_AND_ASSIGN(ReplayFramedSource);
+};
+}
+#endif //RTSP_SERVER_REPLAY_FRAMED_SOURCE_H_
@@ -0,0 +1,461 @@
+// Headless RTSP load generator. Opens N sessions to one server, receives
+// RTP over UDP or TCP, and reports throughput, loss, jitter, join latency and
+// the server's CPU usage. Pair it with a server whose LiveMediaSubSession
+// replays a recorded stream (ReplayOptions) to load-test without cameras.
+//
+//   rtsp_load_client --url=rtsp://127.0.0.1:8554/live --sessions=32
+//                    --transport=tcp --duration=60 --ramp-ms=50
+//                    --server-pid=1234
+//
+// To check a server's admission control against a burst of SETUPs, start
+// more sessions than it should take and bound what it admits:
+//
+//   rtsp_load_client --url=... --sessions=64 --ramp-ms=20 --max-admitted=20
+//
+// The run then passes only if at most 20 sessions were admitted and every
+// admitted session received media.
+
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include "base/at_exit.h"
+#include "base/command_line.h"
+#include "base/files/file_path.h"
+#include "base/files/file_util.h"
+#include "base/logging.h"
+#include "base/macros.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/strings/string_split.h"
+#include "base/strings/stringprintf.h"
+#include "base/time/time.h"
+#include "rtsp/base/percentile.h"
+
+#include <BasicUsageEnvironment.hh>
+#include <liveMedia.hh>
+
+namespace rtsp {
+namespace {
+constexpr char kUrlSwitch[] = "url";
+constexpr char kSessionsSwitch[] = "sessions";
+constexpr char kTransportSwitch[] = "transport";
+constexpr char kDurationSwitch[] = "duration";
+constexpr char kRampSwitch[] = "ramp-ms";
+constexpr char kServerPidSwitch[] = "server-pid";
+constexpr char kMaxAdmittedSwitch[] = "max-admitted";
+
+constexpr unsigned kSinkBufferSize = 512 * 1024;
+// Large enough for a few frames of a high bitrate stream between reads.
+constexpr unsigned kReceiveBufferSize = 2 * 1024 * 1024;
+
+struct Options {
+ std::string url;
+ int sessions = 1;
+ bool tcp = false;
+ base::TimeDelta duration = base::TimeDelta::FromSeconds(30);
+ base::TimeDelta ramp = base::TimeDelta::FromMilliseconds(20);
+ int server_pid = 0;
+ // Fail if the server admits more sessions than this, 0 expects all.
+ int max_admitted = 0;
+};
+
+// Total user+system CPU time of |pid|, from /proc/<pid>/stat.
+bool ReadProcessCpuTime(int pid, base::TimeDelta *cpu_time) {
+  std::string stat;
+  if (!base::ReadFileToString(base::FilePath(base::StringPrintf("/proc/%d/stat", pid)), &stat))
+    return false;
+  // The command name may contain spaces, fields are counted after its ')'.
+  size_t name_end = stat.rfind(')');
+  if (name_end == std::string::npos)
+    return false;
+  std::vector<std::string> fields = base::SplitString(
+      stat.substr(name_end + 1), " ", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY);
+  // utime and stime are fields 14 and 15, the 12th and 13th after ')'.
+  uint64_t utime = 0;
+  uint64_t stime = 0;
+  if (fields.size() < 13 ||
+      !base::StringToUint64(fields[11], &utime) ||
+      !base::StringToUint64(fields[12], &stime)) {
+    return false;
+  }
+  long ticks_per_second = sysconf(_SC_CLK_TCK);
+  *cpu_time = base::TimeDelta::FromMicroseconds(
+      (utime + stime) * base::Time::kMicrosecondsPerSecond / ticks_per_second);
+  return true;
+}
+
+class LoadClient;
+
+// Counts what a subsession delivers and drops it.
+class CountingSink : public MediaSink {
+public:
+ static CountingSink *createNew(UsageEnvironment &env, LoadClient *client) {
+   return new CountingSink(env, client);
+ }
+private:
+ CountingSink(UsageEnvironment &env, LoadClient *client)
+     : MediaSink(env),
+       client_(client),
+       buffer_(new uint8_t[kSinkBufferSize]) {}
+ ~CountingSink() override = default;
+ Boolean continuePlaying() override {
+   if (!fSource)
+     return False;
+   fSource->getNextFrame(buffer_.get(), kSinkBufferSize,
+                         afterGettingFrame, this,
+                         onSourceClosure, this);
+   return True;
+ }
+ static void afterGettingFrame(void *clientData, unsigned frameSize,
+                               unsigned numTruncatedBytes,
+                               struct timeval presentationTime,
+                               unsigned durationInMicroseconds);
+
+ LoadClient *client_;
+ std::unique_ptr<uint8_t[]> buffer_;
+ DISALLOW_COPY_AND_ASSIGN(CountingSink);
+};
+
+class LoadClient : public RTSPClient {
+public:
+ struct Result {
+  bool joined = false;
+  // A SETUP was answered with an error, e.g. 503 from an overloaded server.
+  bool refused = false;
+  base::TimeDelta join_latency;
+  uint64_t bytes = 0;
+  uint64_t frames = 0;
+  uint64_t packets_expected = 0;
+  uint64_t packets_received = 0;
+  double jitter_ms = 0;
+ };
+
+ static LoadClient *createNew(UsageEnvironment &env, const Options &options, int index) {
+   return new LoadClient(env, options, index);
+ }
+
+ void Start() {
+   start_time_ = base::TimeTicks::Now();
+   sendDescribeCommand(continueAfterDESCRIBE);
+ }
+
+ void OnFrame(unsigned frame_size) {
+   if (!result_.joined) {
+     result_.joined = true;
+     result_.join_latency = base::TimeTicks::Now() - start_time_;
+   }
+   result_.bytes += frame_size;
+   ++result_.frames;
+ }
+
+ // Collect the RTP reception statistics, tear the session down and report.
+ Result Stop() {
+   if (session_) {
+     MediaSubsessionIterator iter(*session_);
+     MediaSubsession *subsession;
+     double jitter_sum = 0;
+     unsigned sources = 0;
+     while ((subsession = iter.next()) != nullptr) {
+       if (!subsession->rtpSource())
+         continue;
+       RTPReceptionStatsDB::Iterator stats_iter(subsession->rtpSource()->receptionStatsDB());
+       RTPReceptionStats *stats;
+       while ((stats = stats_iter.next(True)) != nullptr) {
+         result_.packets_expected += stats->totNumPacketsExpected();
+         result_.packets_received += stats->totNumPacketsReceived();
+         // jitter() is in RTP timestamp units.
+         unsigned frequency = subsession->rtpTimestampFrequency();
+         if (frequency) {
+           jitter_sum += stats->jitter() * 1000.0 / frequency;
+           ++sources;
+         }
+       }
+     }
+     if (sources)
+       result_.jitter_ms = jitter_sum / sources;
+     if (has_server_session_)
+       sendTeardownCommand(*session_, nullptr);
+   }
+   return result_;
+ }
+protected:
+ LoadClient(UsageEnvironment &env, const Options &options, int index)
+     : RTSPClient(env, options.url.c_str(), 0, "rtsp_load_client", 0, -1),
+       options_(options),
+       index_(index) {}
+ ~LoadClient() override {
+   CloseSession();
+ }
+private:
+ static void continueAfterDESCRIBE(RTSPClient *rtspClient, int resultCode, char *resultString) {
+   static_cast<LoadClient *>(rtspClient)->OnDescribe(resultCode, resultString);
+   delete[] resultString;
+ }
+ static void continueAfterSETUP(RTSPClient *rtspClient, int resultCode, char *resultString) {
+   static_cast<LoadClient *>(rtspClient)->OnSetup(resultCode, resultString);
+   delete[] resultString;
+ }
+ static void continueAfterPLAY(RTSPClient *rtspClient, int resultCode, char *resultString) {
+   if (resultCode != 0) {
+     LOG(ERROR) << "session " << static_cast<LoadClient *>(rtspClient)->index_
+                << ",PLAY failed:" << (resultString ? resultString : "");
+   }
+   delete[] resultString;
+ }
+ static void subsessionAfterPlaying(void *clientData) {
+   auto subsession = static_cast<MediaSubsession *>(clientData);
+   Medium::close(subsession->sink);
+   subsession->sink = nullptr;
+ }
+
+ void OnDescribe(int resultCode, char *sdp) {
+   if (resultCode != 0 || !sdp) {
+     LOG(ERROR) << "session " << index_ << ",DESCRIBE failed:" << (sdp ? sdp : "");
+     return;
+   }
+   session_ = MediaSession::createNew(envir(), sdp);
+   if (!session_ || !session_->hasSubsessions()) {
+     LOG(ERROR) << "session " << index_ << ",no usable subsession in SDP";
+     return;
+   }
+   iter_.reset(new MediaSubsessionIterator(*session_));
+   SetupNextSubsession();
+ }
+
+ void OnSetup(int resultCode, char *resultString) {
+   if (resultCode != 0) {
+     // A PLAY after this can only fail too.
+     LOG(ERROR) << "session " << index_ << ",SETUP failed:" << (resultString ? resultString : "");
+     result_.refused = true;
+     return;
+   }
+   has_server_session_ = true;
+   if (subsession_->rtpSource()) {
+     subsession_->sink = CountingSink::createNew(envir(), this);
+     subsession_->sink->startPlaying(*subsession_->readSource(), subsessionAfterPlaying, subsession_);
+   }
+   SetupNextSubsession();
+ }
+
+ void SetupNextSubsession() {
+   while ((subsession_ = iter_->next()) != nullptr) {
+     if (!subsession_->initiate())
+       continue;
+     if (subsession_->rtpSource() && !options_.tcp) {
+       int socket_num = subsession_->rtpSource()->RTPgs()->socketNum();
+       increaseReceiveBufferTo(envir(), socket_num, kReceiveBufferSize);
+     }
+     sendSetupCommand(*subsession_, continueAfterSETUP, False, options_.tcp ? True : False);
+     return;
+   }
+   sendPlayCommand(*session_, continueAfterPLAY);
+ }
+
+ void CloseSession() {
+   if (!session_)
+     return;
+   MediaSubsessionIterator iter(*session_);
+   MediaSubsession *subsession;
+   while ((subsession = iter.next()) != nullptr) {
+     Medium::close(subsession->sink);
+     subsession->sink = nullptr;
+   }
+   Medium::close(session_);
+   session_ = nullptr;
+ }
+
+ const Options options_;
+ const int index_;
+ base::TimeTicks start_time_;
+ MediaSession *session_ = nullptr;
+ std::unique_ptr<MediaSubsessionIterator> iter_;
+ MediaSubsession *subsession_ = nullptr;
+ // Set once a SETUP succeeded, the server then holds a session to tear down.
+ bool has_server_session_ = false;
+ Result result_;
+ DISALLOW_COPY_AND_ASSIGN(LoadClient);
+};
+
+void CountingSink::afterGettingFrame(void *clientData, unsigned frameSize,
+                                     unsigned numTruncatedBytes,
+                                     struct timeval presentationTime,
+                                     unsigned durationInMicroseconds) {
+  auto that = static_cast<CountingSink *>(clientData);
+  that->client_->OnFrame(frameSize + numTruncatedBytes);
+  that->continuePlaying();
+}
+
+struct LoadTest {
+ const Options *options;
+ UsageEnvironment *env;
+ std::vector<LoadClient *> clients;
+ // The pending StartNextClient(), if any.
+ TaskToken ramp_task = nullptr;
+ char stop = 0;
+};
+
+void StartNextClient(void *clientData) {
+  auto test = static_cast<LoadTest *>(clientData);
+  test->ramp_task = nullptr;
+  int index = static_cast<int>(test->clients.size());
+  LoadClient *client = LoadClient::createNew(*test->env, *test->options, index);
+  test->clients.push_back(client);
+  client->Start();
+  if (index + 1 < test->options->sessions) {
+    test->ramp_task = test->env->taskScheduler().scheduleDelayedTask(
+        test->options->ramp.InMicroseconds(), StartNextClient, test);
+  }
+}
+
+void StopTest(void *clientData) {
+  auto test = static_cast<LoadTest *>(clientData);
+  // No new clients once the measurement is over.
+  test->env->taskScheduler().unscheduleDelayedTask(test->ramp_task);
+  test->stop = 1;
+}
+
+bool ParseOptions(const base::CommandLine &command_line, Options *options) {
+  options->url = command_line.GetSwitchValueASCII(kUrlSwitch);
+  if (options->url.empty())
+    return false;
+  if (command_line.HasSwitch(kSessionsSwitch) &&
+      !base::StringToInt(command_line.GetSwitchValueASCII(kSessionsSwitch), &options->sessions)) {
+    return false;
+  }
+  if (command_line.HasSwitch(kTransportSwitch)) {
+    const std::string transport = command_line.GetSwitchValueASCII(kTransportSwitch);
+    if (transport != "udp" && transport != "tcp")
+      return false;
+    options->tcp = transport == "tcp";
+  }
+  int value = 0;
+  if (command_line.HasSwitch(kDurationSwitch)) {
+    if (!base::StringToInt(command_line.GetSwitchValueASCII(kDurationSwitch), &value))
+      return false;
+    options->duration = base::TimeDelta::FromSeconds(value);
+  }
+  if (command_line.HasSwitch(kRampSwitch)) {
+    if (!base::StringToInt(command_line.GetSwitchValueASCII(kRampSwitch), &value))
+      return false;
+    options->ramp = base::TimeDelta::FromMilliseconds(value);
+  }
+  if (command_line.HasSwitch(kServerPidSwitch) &&
+      !base::StringToInt(command_line.GetSwitchValueASCII(kServerPidSwitch), &options->server_pid)) {
+    return false;
+  }
+  if (command_line.HasSwitch(kMaxAdmittedSwitch) &&
+      !base::StringToInt(command_line.GetSwitchValueASCII(kMaxAdmittedSwitch), &options->max_admitted)) {
+    return false;
+  }
+  return options->sessions > 0;
+}
+
+int RunLoadTest(const Options &options) {
+  TaskScheduler *scheduler = BasicTaskScheduler::createNew();
+  UsageEnvironment *env = BasicUsageEnvironment::createNew(*scheduler);
+
+  LoadTest test;
+  test.options = &options;
+  test.env = env;
+
+  base::TimeDelta server_cpu_start;
+  bool have_server_cpu = options.server_pid > 0 &&
+      ReadProcessCpuTime(options.server_pid, &server_cpu_start);
+  const base::TimeTicks start = base::TimeTicks::Now();
+
+  scheduler->scheduleDelayedTask(0, StartNextClient, &test);
+  scheduler->scheduleDelayedTask(options.duration.InMicroseconds(), StopTest, &test);
+  env->taskScheduler().doEventLoop(&test.stop);
+
+  const base::TimeDelta elapsed = base::TimeTicks::Now() - start;
+  base::TimeDelta server_cpu_end;
+  have_server_cpu = have_server_cpu && ReadProcessCpuTime(options.server_pid, &server_cpu_end);
+
+  uint64_t total_bytes = 0;
+  uint64_t total_expected = 0;
+  uint64_t total_received = 0;
+  int joined = 0;
+  int refused = 0;
+  int first_refused = -1;
+  std::vector<double> join_ms;
+  std::vector<double> jitter_ms;
+  for (size_t i = 0; i < test.clients.size(); ++i) {
+    LoadClient::Result result = test.clients[i]->Stop();
+    total_bytes += result.bytes;
+    total_expected += result.packets_expected;
+    total_received += result.packets_received;
+    if (result.refused) {
+      if (first_refused < 0)
+        first_refused = static_cast<int>(i);
+      ++refused;
+    }
+    if (result.joined) {
+      ++joined;
+      join_ms.push_back(result.join_latency.InMillisecondsF());
+      // Sessions without media would only add 0 ms and hide the real jitter.
+      jitter_ms.push_back(result.jitter_ms);
+    }
+  }
+  // Let the TEARDOWNs go out before closing the connections.
+  test.stop = 0;
+  scheduler->scheduleDelayedTask(200 * 1000, StopTest, &test);
+  env->taskScheduler().doEventLoop(&test.stop);
+  for (LoadClient *client : test.clients) {
+    Medium::close(client);
+  }
+
+  const double seconds = elapsed.InSecondsF();
+  const uint64_t lost = total_expected > total_received ? total_expected - total_received : 0;
+  printf("sessions      %d/%d joined, %d refused, %d started, transport %s, %.1fs\n",
+         joined, options.sessions, refused, static_cast<int>(test.clients.size()),
+         options.tcp ? "tcp" : "udp", seconds);
+  printf("throughput    %.2f Mbit/s total, %.2f Mbit/s per session\n",
+         total_bytes * 8 / seconds / 1e6,
+         joined ? total_bytes * 8 / seconds / 1e6 / joined : 0.0);
+  printf("loss          %llu of %llu packets (%.3f%%)\n",
+         (unsigned long long) lost, (unsigned long long) total_expected,
+         total_expected ? lost * 100.0 / total_expected : 0.0);
+  printf("jitter        p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+         Percentile(jitter_ms, 0.5), Percentile(jitter_ms, 0.99), Percentile(jitter_ms, 1.0));
+  printf("join latency  p50 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+         Percentile(join_ms, 0.5), Percentile(join_ms, 0.99), Percentile(join_ms, 1.0));
+  if (first_refused >= 0) {
+    printf("admission     first refused session #%d, started %.0f ms into the test\n",
+           first_refused, first_refused * options.ramp.InMillisecondsF());
+  }
+  if (have_server_cpu) {
+    printf("server cpu    %.1f%% of one core\n",
+           (server_cpu_end - server_cpu_start).InSecondsF() * 100 / seconds);
+  }
+
+  env->reclaim();
+  delete scheduler;
+  if (options.max_admitted > 0) {
+    const int admitted = static_cast<int>(test.clients.size()) - refused;
+    if (admitted > options.max_admitted) {
+      printf("FAIL: %d sessions admitted, at most %d expected\n", admitted, options.max_admitted);
+      return 1;
+    }
+    return joined == admitted ? 0 : 1;
+  }
+  return joined == options.sessions ? 0 : 1;
+}
+}
+}
+
+int main(int argc, char *argv[]) {
+  base::AtExitManager at_exit;
+  base::CommandLine::Init(argc, argv);
+  rtsp::Options options;
+  if (!rtsp::ParseOptions(*base::CommandLine::ForCurrentProcess(), &options)) {
+    fprintf(stderr,
+            "usage: %s --url=rtsp://host:port/stream [--sessions=N] [--transport=udp|tcp]\n"
+            "          [--duration=SECONDS] [--ramp-ms=MS] [--server-pid=PID]\n"
+            "          [--max-admitted=N]\n",
+            argv[0]);
+    return 2;
+  }
+  return rtsp::RunLoadTest(options);
+}
@@ -0,0 +1,239 @@
+// Compares event-to-UI latency of the two ways a GUI thread can react to a
+// file descriptor:
+//   direct:  MessagePumpForUIQt::WatchFileDescriptor(), the readiness callback
+//            runs on the GUI thread;
+//   io-hop:  an IO thread watches the fd, reads it and PostTask()s to the GUI
+//            thread, the way it was done before.
+// A writer thread sends its send time through one pipe per path, alternating
+// between them, and the GUI thread records now - sent for each record.
+//
+//   fd_watch_latency_benchmark --samples=5000 --interval-us=2000
+
+#include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include "base/at_exit.h"
+#include "base/bind.h"
+#include "base/command_line.h"
+#include "base/files/file_util.h"
+#include "base/logging.h"
+#include "base/macros.h"
+#include "base/memory/weak_ptr.h"
+#include "base/message_loop/message_loop.h"
+#include "base/message_loop/message_loop_current.h"
+#include "base/message_loop/message_pump_for_io.h"
+#include "base/posix/eintr_wrapper.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/threading/thread.h"
+#include "base/threading/thread_task_runner_handle.h"
+#include "base/time/time.h"
+#include "qt/context_qt.h"
+#include "qt/message_pump_qt.h"
+#include <QCoreApplication>
+
+namespace qt {
+namespace {
+constexpr char kSamplesSwitch[] = "samples";
+constexpr char kIntervalSwitch[] = "interval-us";
+
+int64_t NowMicroseconds() {
+  return (base::TimeTicks::Now() - base::TimeTicks()).InMicroseconds();
+}
+
+// Reads every complete record available on non-blocking |fd|.
+template <typename Callback>
+void ReadRecords(int fd, Callback callback) {
+  int64_t sent;
+  while (HANDLE_EINTR(read(fd, &sent, sizeof(sent))) ==
+         static_cast<ssize_t>(sizeof(sent)))
+    callback(sent);
+}
+
+void PrintLatency(const char *name, std::vector<int64_t> samples) {
+  if (samples.empty()) {
+    printf("%-8s no samples\n", name);
+    return;
+  }
+  std::sort(samples.begin(), samples.end());
+  auto percentile = [&samples](double p) {
+    return samples[std::min(samples.size() - 1,
+                            static_cast<size_t>(p * samples.size()))];
+  };
+  printf("%-8s samples %zu  p50 %lldus  p90 %lldus  p99 %lldus  max %lldus\n",
+         name, samples.size(),
+         static_cast<long long>(percentile(0.5)),
+         static_cast<long long>(percentile(0.9)),
+         static_cast<long long>(percentile(0.99)),
+         static_cast<long long>(samples.back()));
+}
+
+class LatencyBenchmark {
+public:
+ LatencyBenchmark(size_t samples, base::TimeDelta interval)
+     : samples_(samples),
+       interval_(interval),
+       gui_task_runner_(base::ThreadTaskRunnerHandle::Get()),
+       io_thread_("io-hop"),
+       writer_thread_("writer"),
+       direct_watcher_(this),
+       hop_watcher_(this),
+       direct_controller_(FROM_HERE),
+       weak_factory_(this) {
+   weak_this_ = weak_factory_.GetWeakPtr();
+ }
+
+ ~LatencyBenchmark() {
+   weak_factory_.InvalidateWeakPtrs();
+   direct_controller_.StopWatchingFileDescriptor();
+   if (io_thread_.IsRunning()) {
+     io_thread_.task_runner()->PostTask(
+         FROM_HERE, base::BindOnce(&LatencyBenchmark::StopOnIOThread,
+                                   base::Unretained(this)));
+   }
+   writer_thread_.Stop();
+   io_thread_.Stop();
+   for (int fd : {direct_fds_[0], direct_fds_[1], hop_fds_[0], hop_fds_[1]}) {
+     if (fd >= 0)
+       close(fd);
+   }
+ }
+
+ bool Start() {
+   if (!base::CreateLocalNonBlockingPipe(direct_fds_) ||
+       !base::CreateLocalNonBlockingPipe(hop_fds_)) {
+     PLOG(ERROR) << __func__ << ",pipe";
+     return false;
+   }
+   MessagePumpForUIQt::current()->WatchFileDescriptor(
+       direct_fds_[0], true, MessagePumpForUIQt::WATCH_READ,
+       &direct_controller_, &direct_watcher_);
+
+   if (!io_thread_.StartWithOptions(
+       base::Thread::Options(base::MessageLoop::TYPE_IO, 0)) ||
+       !writer_thread_.Start()) {
+     return false;
+   }
+   io_thread_.task_runner()->PostTask(
+       FROM_HERE, base::BindOnce(&LatencyBenchmark::StartOnIOThread,
+                                 base::Unretained(this)));
+   writer_thread_.task_runner()->PostDelayedTask(
+       FROM_HERE, base::BindOnce(&LatencyBenchmark::WriteNext,
+                                 base::Unretained(this)),
+       base::TimeDelta::FromMilliseconds(100));
+   return true;
+ }
+
+ void Report() {
+   PrintLatency("direct", direct_latency_);
+   PrintLatency("io-hop", hop_latency_);
+ }
+
+private:
+ class Watcher : public base::WatchableIOMessagePumpPosix::FdWatcher {
+ public:
+  explicit Watcher(LatencyBenchmark *owner) : owner_(owner) {}
+  void OnFileCanReadWithoutBlocking(int fd) override {
+    owner_->OnReadable(this, fd);
+  }
+  void OnFileCanWriteWithoutBlocking(int fd) override {}
+ private:
+  LatencyBenchmark *owner_;
+ };
+
+ void StartOnIOThread() {
+   hop_controller_.reset(new base::MessagePumpForIO::FdWatchController(FROM_HERE));
+   base::MessageLoopCurrentForIO::Get()->WatchFileDescriptor(
+       hop_fds_[0], true, base::MessagePumpForIO::WATCH_READ,
+       hop_controller_.get(), &hop_watcher_);
+ }
+
+ void StopOnIOThread() {
+   hop_controller_.reset();
+ }
+
+ // Writer thread, alternates between the two pipes.
+ void WriteNext() {
+   int fd = (sent_ % 2 == 0) ? direct_fds_[1] : hop_fds_[1];
+   int64_t now = NowMicroseconds();
+   if (HANDLE_EINTR(write(fd, &now, sizeof(now))) !=
+       static_cast<ssize_t>(sizeof(now)))
+     PLOG(ERROR) << __func__ << ",write";
+   if (++sent_ < 2 * samples_) {
+     writer_thread_.task_runner()->PostDelayedTask(
+         FROM_HERE, base::BindOnce(&LatencyBenchmark::WriteNext,
+                                   base::Unretained(this)),
+         interval_);
+   }
+ }
+
+ void OnReadable(Watcher *watcher, int fd) {
+   if (watcher == &direct_watcher_) {
+     // GUI thread.
+     ReadRecords(fd, [this](int64_t sent) { OnRecord(&direct_latency_, sent); });
+     return;
+   }
+   // IO thread: hop to the GUI thread.
+   ReadRecords(fd, [this](int64_t sent) {
+     gui_task_runner_->PostTask(
+         FROM_HERE, base::BindOnce(&LatencyBenchmark::OnRecord,
+                                   weak_this_, &hop_latency_, sent));
+   });
+ }
+
+ void OnRecord(std::vector<int64_t> *latency, int64_t sent) {
+   latency->push_back(NowMicroseconds() - sent);
+   if (direct_latency_.size() >= samples_ && hop_latency_.size() >= samples_)
+     QCoreApplication::quit();
+ }
+
+ const size_t samples_;
+ const base::TimeDelta interval_;
+ scoped_refptr<base::SingleThreadTaskRunner> gui_task_runner_;
+ base::Thread io_thread_;
+ base::Thread writer_thread_;
+ Watcher direct_watcher_;
+ Watcher hop_watcher_;
+ MessagePumpForUIQt::FdWatchController direct_controller_;
+ // IO thread only.
+ std::unique_ptr<base::MessagePumpForIO::FdWatchController> hop_controller_;
+ int direct_fds_[2] = {-1, -1};
+ int hop_fds_[2] = {-1, -1};
+ // Writer thread only.
+ size_t sent_ = 0;
+ // GUI thread only.
+ std::vector<int64_t> direct_latency_;
+ std::vector<int64_t> hop_latency_;
+ // Bound on the GUI thread, copied by the IO thread for its PostTask()s.
+ base::WeakPtr<LatencyBenchmark> weak_this_;
+ base::WeakPtrFactory<LatencyBenchmark> weak_factory_;
+ DISALLOW_COPY_AND_ASSIGN(LatencyBenchmark);
+};
+}
+}
+
+int main(int argc, char *argv[]) {
+  base::AtExitManager at_exit;
+  base::CommandLine::Init(argc, argv);
+  const base::CommandLine *command_line = base::CommandLine::ForCurrentProcess();
+  size_t samples = 5000;
+  int interval_us = 2000;
+  if (command_line->HasSwitch(qt::kSamplesSwitch))
+    base::StringToSizeT(command_line->GetSwitchValueASCII(qt::kSamplesSwitch), &samples);
+  if (command_line->HasSwitch(qt::kIntervalSwitch))
+    base::StringToInt(command_line->GetSwitchValueASCII(qt::kIntervalSwitch), &interval_us);
+
+  qt::ContextQt::InitMessagePumpForUIFactory();
+  QCoreApplication app(argc, argv);
+  int res = 1;
+  {
+    qt::ContextQt context_qt;
+    qt::LatencyBenchmark benchmark(samples,
+                                   base::TimeDelta::FromMicroseconds(interval_us));
+    if (benchmark.Start()) {
+      res = QCoreApplication::exec();
+      benchmark.Report();
+    }
+  }
+  return res;
+}
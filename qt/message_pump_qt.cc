@@ -2,11 +2,42 @@
 #include "base/task/sequence_manager/thread_controller_with_message_pump_impl.h"
 #include "base/message_loop/message_loop_current.h"
 #include "base/message_loop/message_pump_for_ui.h"
+#include "base/lazy_instance.h"
+#include "base/threading/thread_local.h"
+#include "qt/socket_notifier_relay.h"
+#include <QSocketNotifier>
+#include <QtGlobal>
 
 namespace qt {
 
 namespace {
 
+// The pump owned by the GUI thread's MessageLoopForUI.
+base::LazyInstance<base::ThreadLocalPointer<MessagePumpForUIQt>>::Leaky
+    lazy_pump_tls = LAZY_INSTANCE_INITIALIZER;
+
+// Disconnect and disable |notifier| right away, but let Qt delete it: we may
+// be inside its activated() signal.
+void ReleaseNotifier(QSocketNotifier *&notifier) {
+  if (!notifier)
+    return;
+  notifier->disconnect();
+  notifier->setEnabled(false);
+  notifier->deleteLater();
+  notifier = nullptr;
+}
+
+// See SocketNotifierRelay for why Qt 5.15 connects by signature.
+void ConnectActivated(QSocketNotifier *notifier, std::function<void()> callback) {
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+  auto relay = new SocketNotifierRelay(std::move(callback), notifier);
+  QObject::connect(notifier, SIGNAL(activated(QSocketDescriptor,QSocketNotifier::Type)),
+                   relay, SLOT(activated()));
+#else
+  QObject::connect(notifier, &QSocketNotifier::activated, notifier, std::move(callback));
+#endif
+}
+
 // Return a timeout suitable for the glib loop, -1 to block forever,
 // 0 to return right away, or a timeout in milliseconds from now.
 int GetTimeIntervalMilliseconds(const base::TimeTicks &delayed_work_time) {
@@ -30,15 +61,73 @@ int GetTimeIntervalMilliseconds(const base::TimeTicks &delayed_work_time) {
 
 }  // anonymous namespace
 
+MessagePumpForUIQt::FdWatchController::FdWatchController(const base::Location &from_here)
+    : FdWatchControllerInterface(from_here) {}
+
+MessagePumpForUIQt::FdWatchController::~FdWatchController() {
+  StopWatchingFileDescriptor();
+  if (was_destroyed_) {
+    DCHECK(!*was_destroyed_);
+    *was_destroyed_ = true;
+  }
+}
+
+bool MessagePumpForUIQt::FdWatchController::StopWatchingFileDescriptor() {
+  ReleaseNotifiers();
+  fd_ = -1;
+  watcher_ = nullptr;
+  pump_.reset();
+  return true;
+}
+
+void MessagePumpForUIQt::FdWatchController::ReleaseNotifiers() {
+  ReleaseNotifier(read_notifier_);
+  ReleaseNotifier(write_notifier_);
+}
+
+void MessagePumpForUIQt::FdWatchController::OnActivated(bool readable) {
+  if (!pump_ || !watcher_) {
+    // The notifiers are level-triggered: left enabled after the pump is gone,
+    // they would fire on every pass of the Qt event loop.
+    ReleaseNotifiers();
+    return;
+  }
+  int fd = fd_;
+  FdWatcher *watcher = watcher_;
+  if (!persistent_)
+    StopWatchingFileDescriptor();
+
+  bool destroyed = false;
+  was_destroyed_ = &destroyed;
+  if (readable) {
+    watcher->OnFileCanReadWithoutBlocking(fd);
+  } else {
+    watcher->OnFileCanWriteWithoutBlocking(fd);
+  }
+  if (!destroyed)
+    was_destroyed_ = nullptr;
+}
+
 MessagePumpForUIQt::MessagePumpForUIQt()
     : scheduler_([this]() {
   handleScheduledWork();
-}) {
+}),
+      weak_factory_(this) {
   LOG(INFO) << __func__;
+  DCHECK(!lazy_pump_tls.Pointer()->Get());
+  lazy_pump_tls.Pointer()->Set(this);
 }
 
 MessagePumpForUIQt::~MessagePumpForUIQt() {
   LOG(INFO) << __func__;
+  weak_factory_.InvalidateWeakPtrs();
+  if (lazy_pump_tls.Pointer()->Get() == this)
+    lazy_pump_tls.Pointer()->Set(nullptr);
+}
+
+// static
+MessagePumpForUIQt *MessagePumpForUIQt::current() {
+  return lazy_pump_tls.Pointer()->Get();
 }
 
 void MessagePumpForUIQt::Run(Delegate *) {
@@ -65,6 +154,44 @@ void MessagePumpForUIQt::ScheduleDelayedWork(const base::TimeTicks &delayed_work
   scheduler_.scheduleDelayedWork(GetTimeIntervalMilliseconds(delayed_work_time));
 }
 
+bool MessagePumpForUIQt::WatchFileDescriptor(int fd,
+                                             bool persistent,
+                                             int mode,
+                                             FdWatchController *controller,
+                                             FdWatcher *delegate) {
+  // QSocketNotifier is bound to the thread that creates it.
+  DCHECK_EQ(current(), this);
+  DCHECK_GE(fd, 0);
+  DCHECK(controller);
+  DCHECK(delegate);
+  DCHECK(mode == WATCH_READ || mode == WATCH_WRITE || mode == WATCH_READ_WRITE);
+
+  if (controller->fd_ >= 0 && controller->fd_ != fd) {
+    NOTREACHED() << "Cannot use FdWatchController on two FDs.";
+    return false;
+  }
+  // Like MessagePumpLibevent, watching the same fd again adds to the
+  // existing mode instead of replacing it.
+  controller->fd_ = fd;
+  controller->persistent_ = persistent;
+  controller->watcher_ = delegate;
+  controller->pump_ = weak_factory_.GetWeakPtr();
+
+  if ((mode & WATCH_READ) && !controller->read_notifier_) {
+    controller->read_notifier_ = new QSocketNotifier(fd, QSocketNotifier::Read);
+    ConnectActivated(controller->read_notifier_, [controller]() {
+      controller->OnActivated(true);
+    });
+  }
+  if ((mode & WATCH_WRITE) && !controller->write_notifier_) {
+    controller->write_notifier_ = new QSocketNotifier(fd, QSocketNotifier::Write);
+    ConnectActivated(controller->write_notifier_, [controller]() {
+      controller->OnActivated(false);
+    });
+  }
+  return true;
+}
+
 void MessagePumpForUIQt::ensureDelegate() {
   if (!delegate_) {
     LOG(INFO) << __func__;
@@ -2,25 +2,70 @@
 #define QT_MESSAGE_PUMP_QT_H_
 
 #include "base/macros.h"
+#include "base/location.h"
+#include "base/memory/weak_ptr.h"
 #include "base/message_loop/message_pump.h"
+#include "base/message_loop/watchable_io_message_pump_posix.h"
 #include "qt/message_pump_scheduler.h"
 
+class QSocketNotifier;
+
 namespace qt {
 class MessagePumpForUIQt
-    : public base::MessagePump {
+    : public base::MessagePump,
+      public base::WatchableIOMessagePumpPosix {
 public:
+ // Watches one file descriptor with a QSocketNotifier per direction, so the
+ // readiness callback runs directly on the GUI thread. Same contract as
+ // MessagePumpLibevent::FdWatchController.
+ class FdWatchController : public FdWatchControllerInterface {
+ public:
+  explicit FdWatchController(const base::Location &from_here);
+  ~FdWatchController() override;
+  bool StopWatchingFileDescriptor() override;
+ private:
+  friend class MessagePumpForUIQt;
+  // Called by the read (|readable|) or write notifier.
+  void OnActivated(bool readable);
+  void ReleaseNotifiers();
+
+  int fd_ = -1;
+  bool persistent_ = true;
+  FdWatcher *watcher_ = nullptr;
+  QSocketNotifier *read_notifier_ = nullptr;
+  QSocketNotifier *write_notifier_ = nullptr;
+  // Set by the destructor when it runs inside OnActivated().
+  bool *was_destroyed_ = nullptr;
+  base::WeakPtr<MessagePumpForUIQt> pump_;
+  DISALLOW_COPY_AND_ASSIGN(FdWatchController);
+ };
+
  MessagePumpForUIQt();
  ~MessagePumpForUIQt() override;
  void Run(Delegate *) override;
  void Quit() override;
  void ScheduleWork() override;
  void ScheduleDelayedWork(const base::TimeTicks &delayed_work_time) override;
+
+ // Have the current GUI thread's message loop watch for a non-blocking
+ // |fd| becoming readable or writable. Must be called on the GUI thread.
+ // Intended for low-rate, latency-sensitive descriptors (control sockets,
+ // pipes); bulk I/O still belongs on an IO thread.
+ bool WatchFileDescriptor(int fd,
+                          bool persistent,
+                          int mode,
+                          FdWatchController *controller,
+                          FdWatcher *delegate);
+
+ // The pump of the GUI thread, or nullptr if called on any other thread.
+ static MessagePumpForUIQt *current();
 private:
  void ensureDelegate();
  void handleScheduledWork();
  Delegate *delegate_ = nullptr;
  MessagePumpScheduler scheduler_;
+ base::WeakPtrFactory<MessagePumpForUIQt> weak_factory_;
 };
 }
 
-#endif //QT_MESSAGE_PUMP_QT_H_
\ No newline at end of file
+#endif //QT_MESSAGE_PUMP_QT_H_
@@ -0,0 +1,11 @@
+#include "qt/socket_notifier_relay.h"
+
+namespace qt {
+SocketNotifierRelay::SocketNotifierRelay(std::function<void()> callback, QObject *parent)
+    : QObject(parent),
+      callback_(std::move(callback)) {}
+
+void SocketNotifierRelay::activated() {
+  callback_();
+}
+}
@@ -0,0 +1,25 @@
+#ifndef QT_SOCKET_NOTIFIER_RELAY_H_
+#define QT_SOCKET_NOTIFIER_RELAY_H_
+
+#include "base/macros.h"
+#include <QtCore/qobject.h>
+#include <functional>
+
+namespace qt {
+
+// Since Qt 5.15 QSocketNotifier::activated() is overloaded and private, so
+// its address can not be taken for a functor connect. The relay is connected
+// by signature instead and forwards to |callback|. Parent it to the notifier.
+class SocketNotifierRelay : public QObject {
+Q_OBJECT
+public:
+ SocketNotifierRelay(std::function<void()> callback, QObject *parent);
+public Q_SLOTS:
+ void activated();
+private:
+ std::function<void()> callback_;
+ DISALLOW_COPY_AND_ASSIGN(SocketNotifierRelay);
+};
+}
+
+#endif //QT_SOCKET_NOTIFIER_RELAY_H_